@@ -0,0 +1,130 @@
+#include "defs.hpp"
+#include "ring.hpp"
+
+#ifndef BATCH_H
+#define BATCH_H
+
+
+/*
+    Collects the meshes drawn with the main shader during a frame and submits them together
+    Meshes are grouped by primitive, each group goes to the ring buffer in one piece and is drawn with
+    a single glMultiDrawElementsBaseVertex, so the number of draw calls does not grow with the number of objects
+    Groups keep the order the meshes were added in, later ones are drawn on top
+*/
+
+class BatchGroup{
+public:
+    std::vector<GLfloat> vertices;
+    std::vector<unsigned int> indices;
+
+    // Per mesh index count, first index and first vertex inside the group
+    std::vector<GLsizei> counts;
+    std::vector<size_t> firsts;
+    std::vector<GLint> bases;
+
+    void clear(){
+        vertices.clear();
+        indices.clear();
+        counts.clear();
+        firsts.clear();
+        bases.clear();
+    }
+};
+
+class Batch{
+public:
+    std::map<GLenum, BatchGroup> groups;
+
+    // Meshes and draw calls of the last flush
+    int items;
+    int draw_calls;
+
+    Batch(){
+        items = 0;
+        draw_calls = 0;
+    }
+
+    // Queues a mesh moved by the given offset
+    int add(GLenum, std::vector<GLfloat>&, std::vector<unsigned int>&, glm::vec3 offset = glm::vec3(0.0f));
+    // Draws everything queued since the last flush
+    int flush(unsigned int);
+};
+
+int Batch::add(GLenum mode, std::vector<GLfloat> &vertices, std::vector<unsigned int> &indices, glm::vec3 offset){
+    if(vertices.empty() || indices.empty())
+        return EXT_FAIL;
+
+    BatchGroup &group = groups[mode];
+
+    group.counts.push_back(indices.size());
+    group.firsts.push_back(group.indices.size());
+    group.bases.push_back(group.vertices.size()/6);
+
+    group.indices.insert(group.indices.end(), indices.begin(), indices.end());
+
+    size_t first = group.vertices.size();
+    group.vertices.insert(group.vertices.end(), vertices.begin(), vertices.end());
+    for(size_t i = first; i<group.vertices.size(); i+=6){
+        group.vertices[i] += offset.x;
+        group.vertices[i+1] += offset.y;
+        group.vertices[i+2] += offset.z;
+    }
+
+    return EXT_SUCC;
+}
+
+int Batch::flush(unsigned int shaderProgram){
+    items = 0;
+    draw_calls = 0;
+
+    glUseProgram(shaderProgram);
+
+    // Everything is already in world space
+    glm::mat4 model = glm::mat4(1.0f);
+    glm::mat4 view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
+    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
+    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
+
+    int ret = EXT_SUCC;
+    size_t stride = 6*sizeof(GLfloat);
+
+    for(auto it = groups.begin(); it != groups.end(); it++){
+        BatchGroup &group = it->ss;
+        if(group.counts.empty())
+            continue;
+
+        // Vertices are placed on a whole vertex so the base vertex can point at them
+        long long vertex_offset = frame_stream.push(&group.vertices[0], group.vertices.size()*sizeof(GLfloat), stride);
+        long long index_offset = -1;
+        if(vertex_offset != -1)
+            index_offset = frame_stream.push(&group.indices[0], group.indices.size()*sizeof(unsigned int), sizeof(unsigned int));
+
+        if(index_offset == -1){
+            ret = EXT_FAIL;
+            group.clear();
+            continue;
+        }
+
+        std::vector<const void*> offsets(group.counts.size());
+        for(int i = 0; i<group.counts.size(); i++){
+            offsets[i] = (const void*)(index_offset + group.firsts[i]*sizeof(unsigned int));
+            group.bases[i] += vertex_offset/stride;
+        }
+
+        glBindVertexArray(frame_stream.vao);
+        glMultiDrawElementsBaseVertex(it->ff, &group.counts[0], GL_UNSIGNED_INT, &offsets[0], group.counts.size(), &group.bases[0]);
+
+        items += group.counts.size();
+        draw_calls++;
+        group.clear();
+    }
+
+    glBindVertexArray(0);
+
+    return ret;
+}
+
+// Shared by everything drawn with the main shader
+Batch frame_batch;
+
+#endif
@@ -0,0 +1,278 @@
+#include "defs.hpp"
+
+#include <cmath>
+#include <string>
+
+#ifndef BENCH_H
+#define BENCH_H
+
+
+/*
+    Results shared by the benchmark tools
+    Each metric keeps one sample per repetition and is written with its mean and 95% confidence interval to a
+    JSON file of a fixed schema. A file written earlier can be loaded back as the baseline of the next run, and
+    a tracked metric that got slower by more than the threshold, beyond what the noise of both runs explains,
+    makes the benchmark exit with a failure status
+*/
+
+// Version of the JSON layout, bumped when a field changes meaning
+#define BENCH_SCHEMA         1
+// Slowdown of a tracked metric that fails the comparison, as a fraction of the baseline
+#define BENCH_THRESHOLD   0.05
+
+// Two sided 95% quantiles of Student's t for 1 to 30 degrees of freedom, the normal one above that
+const double bench_t95[30] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                               2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                               2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+
+class BenchMetric{
+public:
+    std::string name;
+    std::string unit;
+    // Only tracked metrics can fail a comparison, the others are printed next to them
+    bool tracked;
+    // Lower is better for every metric, they are all times
+    std::vector<double> samples;
+
+    BenchMetric(){
+        tracked = false;
+    }
+
+    double mean();
+    // Half width of the 95% confidence interval of the mean
+    double ci95();
+};
+
+double BenchMetric::mean(){
+    if(samples.empty())
+        return 0;
+    double sum = 0;
+    for(int i = 0; i<samples.size(); i++)
+        sum += samples[i];
+    return sum/samples.size();
+}
+
+double BenchMetric::ci95(){
+    int n = samples.size();
+    if(n < 2)
+        return 0;
+    double m = mean(), sum = 0;
+    for(int i = 0; i<n; i++)
+        sum += (samples[i] - m)*(samples[i] - m);
+    double t = n-1 <= 30 ? bench_t95[n-2] : 1.96;
+    return t*sqrt(sum/(n-1))/sqrt((double)n);
+}
+
+class BenchResults{
+public:
+    const char *bench;
+    std::vector<BenchMetric> metrics;
+
+    // Set from the command line by flag
+    const char *json_path;
+    const char *baseline_path;
+    double threshold;
+    int reps;
+
+    BenchResults(const char *name, int default_reps){
+        bench = name;
+        json_path = NULL;
+        baseline_path = NULL;
+        threshold = BENCH_THRESHOLD;
+        reps = default_reps;
+    }
+
+    // Reads --json, --baseline, --threshold and --reps at argv[i], true when it was one of them
+    bool flag(int, char**, int&);
+    // Adds a sample to the metric of that name, creating it the first time
+    void add(const char*, const char*, double, bool = false);
+    BenchMetric *find(const std::string&);
+
+    int write(const char*);
+    int load(const char*);
+    // Prints this run against the baseline, EXT_FAIL when a tracked metric regressed
+    int compare(BenchResults&);
+    // Writes and compares as asked on the command line, EXT_FAIL when either failed
+    int finish();
+};
+
+bool BenchResults::flag(int argc, char **argv, int &i){
+    if(strcmp(argv[i], "--json") == 0 && i+1 < argc)
+        json_path = argv[++i];
+    else if(strcmp(argv[i], "--baseline") == 0 && i+1 < argc)
+        baseline_path = argv[++i];
+    else if(strcmp(argv[i], "--threshold") == 0 && i+1 < argc)
+        threshold = atof(argv[++i])/100.0;
+    else if(strcmp(argv[i], "--reps") == 0 && i+1 < argc){
+        // max evaluates its arguments twice
+        int count = atoi(argv[++i]);
+        reps = max(count, 1);
+    }
+    else
+        return false;
+    return true;
+}
+
+BenchMetric *BenchResults::find(const std::string &name){
+    for(int i = 0; i<metrics.size(); i++)
+        if(metrics[i].name == name)
+            return &metrics[i];
+    return NULL;
+}
+
+void BenchResults::add(const char *name, const char *unit, double value, bool tracked){
+    BenchMetric *metric = find(name);
+    if(metric == NULL){
+        metrics.push_back(BenchMetric());
+        metric = &metrics.back();
+        metric->name = name;
+        metric->unit = unit;
+        metric->tracked = tracked;
+    }
+    metric->samples.push_back(value);
+}
+
+int BenchResults::write(const char *path){
+    FILE *out = fopen(path, "w");
+    if(out == NULL)
+        return EXT_FAIL;
+
+    fprintf(out, "{\n\"schema\": %d,\n\"bench\": \"%s\",\n\"metrics\": [", BENCH_SCHEMA, bench);
+    for(int i = 0; i<metrics.size(); i++){
+        BenchMetric &metric = metrics[i];
+        fprintf(out, "%s\n{\"name\": \"%s\", \"unit\": \"%s\", \"tracked\": %s, \"mean\": %.6g, \"ci95\": %.6g, \"samples\": [",
+                i == 0 ? "" : ",", metric.name.c_str(), metric.unit.c_str(), metric.tracked ? "true" : "false", metric.mean(), metric.ci95());
+        for(int j = 0; j<metric.samples.size(); j++)
+            fprintf(out, "%s%.6g", j == 0 ? "" : ", ", metric.samples[j]);
+        fprintf(out, "]}");
+    }
+    fprintf(out, "\n]\n}\n");
+    fclose(out);
+
+    return EXT_SUCC;
+}
+
+// Value of the string field after the given key, searched from pos, moves pos past it
+bool bench_string(const std::string &text, const char *key, size_t &pos, std::string &value){
+    size_t at = text.find(key, pos);
+    if(at == std::string::npos)
+        return false;
+    size_t begin = text.find('"', text.find(':', at) + 1);
+    size_t end = text.find('"', begin + 1);
+    if(begin == std::string::npos || end == std::string::npos)
+        return false;
+    value = text.substr(begin + 1, end - begin - 1);
+    pos = end + 1;
+    return true;
+}
+
+// Only reads files in the layout write produces, it is not a general JSON parser
+int BenchResults::load(const char *path){
+    FILE *in = fopen(path, "r");
+    if(in == NULL)
+        return EXT_FAIL;
+    std::string text;
+    char buffer[4096];
+    size_t read;
+    while((read = fread(buffer, 1, sizeof(buffer), in)) > 0)
+        text.append(buffer, read);
+    fclose(in);
+
+    size_t schema = text.find("\"schema\"");
+    if(schema == std::string::npos || atoi(text.c_str() + text.find(':', schema) + 1) != BENCH_SCHEMA)
+        return EXT_FAIL;
+
+    metrics.clear();
+    size_t pos = text.find("\"metrics\"");
+    std::string name, unit;
+    while(pos != std::string::npos && bench_string(text, "\"name\"", pos, name) && bench_string(text, "\"unit\"", pos, unit)){
+        BenchMetric metric;
+        metric.name = name;
+        metric.unit = unit;
+
+        size_t tracked = text.find("\"tracked\"", pos);
+        size_t samples = text.find("\"samples\"", pos);
+        if(samples == std::string::npos)
+            return EXT_FAIL;
+        metric.tracked = tracked < samples && text.compare(text.find(':', tracked) + 2, 4, "true") == 0;
+
+        // Numbers up to the closing bracket
+        const char *cursor = text.c_str() + text.find('[', samples) + 1;
+        while(*cursor != ']' && *cursor != '\0'){
+            char *end;
+            double value = strtod(cursor, &end);
+            if(end == cursor){
+                cursor++;
+                continue;
+            }
+            metric.samples.push_back(value);
+            cursor = end;
+        }
+        pos = cursor - text.c_str();
+        metrics.push_back(metric);
+    }
+
+    return EXT_SUCC;
+}
+
+/*
+    A tracked metric regresses when its mean is more than the threshold above the baseline's and the two
+    confidence intervals do not overlap, so a noisy run needs a larger slowdown to fail
+*/
+int BenchResults::compare(BenchResults &baseline){
+    int ret = EXT_SUCC;
+
+    printf("\n%-32s %20s %20s %9s  %s\n", "metric", "baseline", "current", "change", "");
+    for(int i = 0; i<metrics.size(); i++){
+        BenchMetric &metric = metrics[i];
+        BenchMetric *base = baseline.find(metric.name);
+        if(base == NULL || base->mean() <= 0){
+            printf("%-32s %20s %12.4g +- %-6.2g %9s  new\n", metric.name.c_str(), "", metric.mean(), metric.ci95(), "");
+            continue;
+        }
+
+        double change = metric.mean()/base->mean() - 1;
+        bool apart = metric.mean() - metric.ci95() > base->mean() + base->ci95() ||
+                     metric.mean() + metric.ci95() < base->mean() - base->ci95();
+
+        const char *verdict = "";
+        if(apart && change > threshold && metric.tracked){
+            verdict = "REGRESSED";
+            ret = EXT_FAIL;
+        }
+        else if(apart && change > threshold)
+            verdict = "slower";
+        else if(apart && change < -threshold)
+            verdict = "faster";
+
+        printf("%-32s %12.4g +- %-6.2g %12.4g +- %-6.2g %+8.1f%%  %s\n", metric.name.c_str(), base->mean(), base->ci95(),
+               metric.mean(), metric.ci95(), change*100, verdict);
+    }
+
+    if(ret == EXT_FAIL)
+        printf("\nA tracked metric is more than %.1f%% slower than %s\n", threshold*100, baseline_path);
+    return ret;
+}
+
+int BenchResults::finish(){
+    int ret = EXT_SUCC;
+
+    if(json_path != NULL && write(json_path) == EXT_FAIL){
+        printf("Could not write the results to %s\n", json_path);
+        ret = EXT_FAIL;
+    }
+
+    if(baseline_path != NULL){
+        BenchResults baseline(bench, 0);
+        if(baseline.load(baseline_path) == EXT_FAIL){
+            printf("Could not read the baseline %s\n", baseline_path);
+            return EXT_FAIL;
+        }
+        if(compare(baseline) == EXT_FAIL)
+            ret = EXT_FAIL;
+    }
+
+    return ret;
+}
+
+#endif
@@ -0,0 +1,113 @@
+#include "defs.hpp"
+
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
+
+/*
+    Hardware performance counters through Linux perf events
+    Each thread opens its own group of counters the first time a zone reads them, and the group is read as a whole
+    so all counters cover the same instructions. Only user space is counted, which most kernels allow
+    without extra permissions. Elsewhere, or when the kernel refuses, the counters stay off
+*/
+
+#define HW_CYCLES            0
+#define HW_INSTRUCTIONS      1
+#define HW_CACHE_MISSES      2
+#define HW_BRANCH_MISSES     3
+#define NUM_HW_COUNTERS      4
+
+const char *hw_counter_names[NUM_HW_COUNTERS] = {"cycles", "instructions", "cache misses", "branch misses"};
+
+class HwCounters{
+public:
+    std::atomic<bool> enabled;
+
+    HwCounters(){
+        enabled = false;
+    }
+
+    // Turns the counters on if the calling thread can open them
+    int enable();
+    // Group leader of the calling thread, -1 when it could not be opened
+    int group();
+    int read(long long*);
+};
+
+int HwCounters::group(){
+    static thread_local int leader = -2;
+    if(leader != -2)
+        return leader;
+    leader = -1;
+
+#ifdef __linux__
+    unsigned long long configs[NUM_HW_COUNTERS] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                                   PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+    int fds[NUM_HW_COUNTERS];
+
+    for(int i = 0; i<NUM_HW_COUNTERS; i++){
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = configs[i];
+        attr.read_format = PERF_FORMAT_GROUP;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        // The group starts once every member is open
+        attr.disabled = (i == 0);
+
+        fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, i == 0 ? -1 : fds[0], 0);
+        if(fds[i] == -1){
+            for(int j = 0; j<i; j++)
+                close(fds[j]);
+            return leader;
+        }
+    }
+
+    ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    leader = fds[0];
+#endif
+
+    return leader;
+}
+
+int HwCounters::enable(){
+    if(group() == -1){
+        printf("Hardware counters are not available, check /proc/sys/kernel/perf_event_paranoid\n");
+        return EXT_FAIL;
+    }
+    enabled = true;
+    return EXT_SUCC;
+}
+
+int HwCounters::read(long long *values){
+    int leader = group();
+    if(leader == -1)
+        return EXT_FAIL;
+
+#ifdef __linux__
+    // Number of counters followed by their values, in the order they were opened
+    unsigned long long data[1 + NUM_HW_COUNTERS];
+    if(::read(leader, data, sizeof(data)) != sizeof(data) || data[0] != NUM_HW_COUNTERS)
+        return EXT_FAIL;
+    for(int i = 0; i<NUM_HW_COUNTERS; i++)
+        values[i] = data[1+i];
+    return EXT_SUCC;
+#else
+    return EXT_FAIL;
+#endif
+}
+
+// Shared by every thread, each of them has its own counters underneath
+HwCounters hw_counters;
+
+#endif
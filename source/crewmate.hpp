@@ -0,0 +1,219 @@
+#include "defs.hpp"
+
+#ifndef CREWMATE_H
+#define CREWMATE_H
+
+
+/*
+    One crewmate mesh shared by every entity
+    Each vertex has its position around the crewmate's centre and whether it belongs to the visor,
+    the position, body and visor colors and visibility of every entity go in uniform arrays and
+    all of them are drawn together with an instanced draw
+    With sdf set every crewmate is a single quad instead and the fragment shader works out the shape
+*/
+
+// Room left around the quad for the anti-aliased edge, in crewmate sizes
+#define SDF_MARGIN       0.05f
+
+void crewmate_mesh(std::vector<GLfloat> &vertices, std::vector<unsigned short> &indices){
+    float width = ((float)CELL_WIDTH/SCR_WIDTH) * 0.3;
+    float height = ((float)CELL_WIDTH/SCR_HEIGHT) * 0.3;
+
+    vertices.clear();
+    indices.clear();
+
+    // rectangle
+    for(int i = -1; i<=1; i+=2){
+        for(int j = -1; j<=1; j+=2){
+            vertices.insert(vertices.end(), {j*width/2, i*height/2, 0.0f});
+        }
+    }
+
+    for(unsigned short i = 0; i<=1; i++){
+        indices.insert(indices.end(), {i, (unsigned short)(i+1), (unsigned short)(i+2)});
+    }
+
+    // visor
+    for(int i = -1; i<=1; i+=2){
+        for(int j = -1; j<=1; j+=2){
+            vertices.insert(vertices.end(), {j*width/3, height/2+i*height/4, 1.0f});
+        }
+    }
+
+    for(unsigned short i = 0; i<=1; i++){
+        indices.insert(indices.end(), {(unsigned short)(4+i), (unsigned short)(5+i), (unsigned short)(6+i)});
+    }
+
+    //semi-circle
+    vertices.insert(vertices.end(), {0.0f, height/2, 0.0f});
+
+    float cur_angle = 0;
+    float increment = 5.0;
+
+    for(int i = 0; i<= 180.0/increment; i++){
+        vertices.insert(vertices.end(), {(width/2)*(float)cos(cur_angle), (height/2)*(1+(float)sin(cur_angle)), 0.0f});
+        cur_angle += glm::radians(increment);
+    }
+
+    for(unsigned short i = 0; i<180.0/increment; i++){
+        indices.insert(indices.end(), {8, (unsigned short)(i+9), (unsigned short)(i+10)});
+    }
+}
+
+void crewmate_quad(std::vector<GLfloat> &vertices, std::vector<unsigned short> &indices){
+    // The body spans -0.5 to 0.5 both ways and the dome reaches 1 above the centre
+    float x_low = -0.5f - SDF_MARGIN, x_high = 0.5f + SDF_MARGIN;
+    float y_low = -0.5f - SDF_MARGIN, y_high = 1.0f + SDF_MARGIN;
+
+    vertices.assign({x_low, y_low, x_high, y_low, x_low, y_high, x_high, y_high});
+    indices.assign({0, 1, 2, 1, 2, 3});
+}
+
+class CrewmateRenderer{
+public:
+    // Draws every crewmate as one quad shaded from distance fields, set before init
+    bool sdf;
+
+    unsigned int vao;
+    unsigned int vbo;
+    unsigned int ebo;
+    int index_count;
+
+    // Queued this frame, x, y and visibility of each
+    std::vector<glm::vec4> placements;
+    std::vector<glm::vec3> bodies;
+    std::vector<glm::vec3> visors;
+
+    // Crewmates and draw calls of the last flush
+    int drawn;
+    int draw_calls;
+
+    CrewmateRenderer(){
+        sdf = false;
+        vao = vbo = ebo = 0;
+        index_count = 0;
+        drawn = 0;
+        draw_calls = 0;
+    }
+
+    // Needs a current context
+    int init();
+    void release();
+
+    void add(glm::vec3, float, glm::vec3, glm::vec3);
+    int flush();
+};
+
+int CrewmateRenderer::init(){
+    std::vector<GLfloat> vertices;
+    std::vector<unsigned short> indices;
+    if(sdf)
+        crewmate_quad(vertices, indices);
+    else
+        crewmate_mesh(vertices, indices);
+    index_count = indices.size();
+
+    glGenVertexArrays(1, &vao);
+    glGenBuffers(1, &vbo);
+    glGenBuffers(1, &ebo);
+
+    glBindVertexArray(vao);
+
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size()*sizeof(GLfloat), &vertices[0], GL_STATIC_DRAW);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size()*sizeof(unsigned short), &indices[0], GL_STATIC_DRAW);
+
+    if(sdf){
+        // position attribute
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(0);
+    }
+    else{
+        // position attribute
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(0);
+        // 1 on the visor, 0 on the body
+        glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)(2 * sizeof(float)));
+        glEnableVertexAttribArray(1);
+    }
+
+    glBindVertexArray(0);
+
+    return EXT_SUCC;
+}
+
+void CrewmateRenderer::release(){
+    if(vao == 0)
+        return;
+    glDeleteVertexArrays(1, &vao);
+    glDeleteBuffers(1, &vbo);
+    glDeleteBuffers(1, &ebo);
+    vao = vbo = ebo = 0;
+}
+
+void CrewmateRenderer::add(glm::vec3 position, float tint, glm::vec3 body, glm::vec3 visor){
+    placements.push_back(glm::vec4(position.x, position.y, tint, 0.0f));
+    bodies.push_back(body);
+    visors.push_back(visor);
+}
+
+int CrewmateRenderer::flush(){
+    drawn = 0;
+    draw_calls = 0;
+
+    if(vao == 0 || placements.empty()){
+        placements.clear();
+        bodies.clear();
+        visors.clear();
+        return EXT_FAIL;
+    }
+
+    unsigned int program = sdf ? crewmate_sdf_shader : crewmate_shader;
+    glUseProgram(program);
+
+    glm::mat4 view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
+    glUniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE, glm::value_ptr(view));
+
+    unsigned int placementLoc = glGetUniformLocation(program, "placement");
+    unsigned int bodyLoc = glGetUniformLocation(program, "body");
+    unsigned int visorLoc = glGetUniformLocation(program, "visor");
+
+    if(sdf){
+        // Same size as the mesh, the edges are blended
+        glUniform2f(glGetUniformLocation(program, "size"), width*0.3f, height*0.3f);
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    }
+
+    glBindVertexArray(vao);
+
+    // The uniform arrays hold CREWMATE_BATCH entities at a time
+    for(int first = 0; first<placements.size(); first+=CREWMATE_BATCH){
+        int count = min((int)placements.size() - first, CREWMATE_BATCH);
+
+        glUniform4fv(placementLoc, count, glm::value_ptr(placements[first]));
+        glUniform3fv(bodyLoc, count, glm::value_ptr(bodies[first]));
+        glUniform3fv(visorLoc, count, glm::value_ptr(visors[first]));
+
+        glDrawElementsInstanced(GL_TRIANGLES, index_count, GL_UNSIGNED_SHORT, 0, count);
+        draw_calls++;
+    }
+
+    glBindVertexArray(0);
+    if(sdf)
+        glDisable(GL_BLEND);
+
+    drawn = placements.size();
+    placements.clear();
+    bodies.clear();
+    visors.clear();
+
+    return EXT_SUCC;
+}
+
+// Shared by every entity drawn as a crewmate
+CrewmateRenderer crewmates;
+
+#endif
@@ -7,6 +7,7 @@
 #include<time.h>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
+#include "resources.hpp"
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
@@ -28,6 +29,12 @@
 #define WEST                4
 #define EAST                5
 
+#define GEN_BACKTRACKER     0
+#define GEN_WILSON          1
+#define GEN_KRUSKAL         2
+#define GEN_DIVISION        3
+#define NUM_GENERATORS      4
+
 #define ff              first
 #define ss             second
 
@@ -41,9 +48,32 @@
 #define NUM_POWERUP        10
 #define TIME_LIMIT        120
 
+// Wall thickness in pixels used by --thick-walls
+#define WALL_THICKNESS     4
+
+// Cells per side of a wall mesh chunk
+#define MESH_CHUNK         16
+
+// Crewmates drawn by one instanced draw, the size of the crewmate shader's uniform arrays
+#define CREWMATE_BATCH     64
+
+// Subdivisions of a cell in the packed wall vertex positions
+#define GRID_UNITS        256
+
+// Bytes of the next maze's geometry sent to the GPU per frame
+#define UPLOAD_BUDGET  (1<<20)
+
+// 0 compiles the profiling zones out
+#ifndef PROFILER
+#define PROFILER            1
+#endif
+
 #define INF               1e9
 #define GRADIENT          0.2
 
+#define STRINGIFY(x)    #x
+#define TO_STRING(x)    STRINGIFY(x)
+
 #define min(a, b)   (a<b?a:b)
 #define max(a, b)   (a>b?a:b)
 
@@ -51,6 +81,9 @@
 // Global variables
 unsigned int shaderProgram;
 unsigned int text_shader;
+unsigned int grid_shader;
+unsigned int crewmate_shader;
+unsigned int crewmate_sdf_shader;
 GLFWwindow *window;
 
 glm::vec3 cameraPos = glm::vec3(0.0, 0.0, 1.0);
@@ -59,4 +92,6 @@ glm::vec3 cameraUp = glm::vec3(0.0, 1.0, 0.0);
 glm::vec3 cameraRight = glm::vec3(1.0, 0.0, 0.0);
 float width = (float)CELL_WIDTH/SCR_WIDTH;
 float height = (float)CELL_WIDTH/SCR_HEIGHT;
+// Thickness of the walls in pixels, 0 draws them as lines
+float wall_thickness = 0;
 #endif
\ No newline at end of file
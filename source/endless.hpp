@@ -0,0 +1,267 @@
+#include "defs.hpp"
+#include "world.hpp"
+#include "stream.hpp"
+#include "jobs.hpp"
+
+#ifndef ENDLESS_H
+#define ENDLESS_H
+
+
+/*
+    Endless maze made of ENDLESS_CHUNK x ENDLESS_CHUNK chunks
+    Every chunk is a perfect maze with loops carved in, seeded by hash(seed, chunk x, chunk y)
+    Each chunk has one gap in its south and east edge, picked by hashing the edge,
+    so both neighbours agree on it without having to be generated together
+*/
+
+#define ENDLESS_CHUNK        32
+// Most chunks kept in memory, the least recently used go first
+#define ENDLESS_CACHE        64
+// Chunks generated ahead of the player in the direction of travel
+#define ENDLESS_LOOKAHEAD     2
+
+unsigned long long mix_hash(unsigned long long x){
+    // splitmix64 finaliser
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+unsigned long long chunk_hash(unsigned int seed, long long cx, long long cy, int salt){
+    unsigned long long h = mix_hash(seed);
+    h = mix_hash(h ^ (unsigned long long)cx);
+    h = mix_hash(h ^ (unsigned long long)cy);
+    return mix_hash(h ^ (unsigned long long)salt);
+}
+
+long long floor_div(long long a, long long b){
+    return a >= 0 ? a/b : -((-a + b - 1)/b);
+}
+
+class WorldChunk{
+public:
+    long long cx;
+    long long cy;
+    // Packed south and east walls, see stream.hpp
+    std::vector<unsigned char> walls;
+    // Set once a worker has filled the walls
+    std::atomic<bool> ready;
+    // Job generating the walls, only valid while they are not ready, the job system frees it once it is done
+    Job *job;
+    std::list<WorldChunk*>::iterator lru;
+
+    WorldChunk(long long x, long long y){
+        cx = x;
+        cy = y;
+        ready = false;
+        job = NULL;
+    }
+
+    void generate(unsigned int);
+};
+
+class ChunkWorld{
+public:
+    unsigned int seed;
+    JobSystem *jobs;
+
+    std::map<std::pair<long long, long long>, WorldChunk*> chunks;
+    // Most recently used at the front
+    std::list<WorldChunk*> lru;
+
+    long long generated;
+    long long evicted;
+
+    ChunkWorld(unsigned int s, JobSystem *j = NULL){
+        seed = s;
+        jobs = j;
+        generated = 0;
+        evicted = 0;
+    }
+
+    ~ChunkWorld(){
+        for(auto it = chunks.begin(); it != chunks.end(); it++){
+            // Without workers a prefetched chunk only gets generated if this thread runs it
+            if(!it->ss->ready)
+                jobs->wait(it->ss->job);
+            delete it->ss;
+        }
+    }
+
+    // Column of the gap in the south edge and row of the gap in the east edge of a chunk
+    int south_gap(long long, long long);
+    int east_gap(long long, long long);
+
+    // Chunk holding the cell, generated on the spot if no worker got to it yet
+    WorldChunk *get(long long, long long);
+    // Starts generating a chunk on a worker if it is not there yet
+    WorldChunk *request(long long, long long);
+    void evict();
+
+    int walls(long long, long long);
+    Node cell(long long, long long);
+
+    // Requests the chunks around a cell and further ahead in the direction of travel
+    void prefetch(long long, long long, int, int);
+
+    size_t memory();
+};
+
+void WorldChunk::generate(unsigned int seed){
+    std::mt19937 rng(chunk_hash(seed, cx, cy, 0));
+
+    Maze local(ENDLESS_CHUNK, ENDLESS_CHUNK, rng(), GEN_BACKTRACKER);
+    Generator *generator = make_generator(local.engine);
+    generator->generate(local);
+    delete generator;
+    local.carve_loops();
+
+    walls.assign(packed_row_bytes(ENDLESS_CHUNK)*ENDLESS_CHUNK, 0);
+    for(int i = 0; i<ENDLESS_CHUNK; i++){
+        unsigned char *row = &walls[i*packed_row_bytes(ENDLESS_CHUNK)];
+        for(int j = 0; j<ENDLESS_CHUNK; j++){
+            int w = 0;
+            if(local.maze[i][j].south == WALL)
+                w |= WALL_SOUTH_BIT;
+            if(local.maze[i][j].east == WALL)
+                w |= WALL_EAST_BIT;
+            pack_walls(row, j, w);
+        }
+    }
+
+    ready = true;
+}
+
+int ChunkWorld::south_gap(long long cx, long long cy){
+    return chunk_hash(seed, cx, cy, SOUTH) % ENDLESS_CHUNK;
+}
+
+int ChunkWorld::east_gap(long long cx, long long cy){
+    return chunk_hash(seed, cx, cy, EAST) % ENDLESS_CHUNK;
+}
+
+WorldChunk *ChunkWorld::request(long long cx, long long cy){
+    std::pair<long long, long long> key = std::make_pair(cx, cy);
+    auto it = chunks.find(key);
+
+    if(it != chunks.end()){
+        lru.splice(lru.begin(), lru, it->ss->lru);
+        return it->ss;
+    }
+
+    WorldChunk *chunk = new WorldChunk(cx, cy);
+    lru.push_front(chunk);
+    chunk->lru = lru.begin();
+    chunks[key] = chunk;
+    generated++;
+
+    unsigned int s = seed;
+    if(jobs != NULL)
+        chunk->job = jobs->add("generate_chunk", [chunk, s](){ chunk->generate(s); });
+    else
+        chunk->generate(s);
+
+    evict();
+    return chunk;
+}
+
+WorldChunk *ChunkWorld::get(long long cx, long long cy){
+    WorldChunk *chunk = request(cx, cy);
+
+    // Help the workers instead of idling if the chunk is still being built
+    if(!chunk->ready)
+        jobs->wait(chunk->job);
+
+    return chunk;
+}
+
+void ChunkWorld::evict(){
+    // Chunks still being generated are skipped, they are never more than a few
+    auto it = lru.end();
+    while(chunks.size() > ENDLESS_CACHE && it != lru.begin()){
+        it--;
+        WorldChunk *chunk = *it;
+        if(!chunk->ready)
+            continue;
+
+        chunks.erase(std::make_pair(chunk->cx, chunk->cy));
+        it = lru.erase(it);
+        delete chunk;
+        evicted++;
+    }
+}
+
+int ChunkWorld::walls(long long r, long long c){
+    long long cy = floor_div(r, ENDLESS_CHUNK);
+    long long cx = floor_div(c, ENDLESS_CHUNK);
+    int lr = r - cy*ENDLESS_CHUNK;
+    int lc = c - cx*ENDLESS_CHUNK;
+
+    WorldChunk *chunk = get(cx, cy);
+    int w = packed_walls(&chunk->walls[lr*packed_row_bytes(ENDLESS_CHUNK)], lc);
+
+    // The chunk's own border is solid apart from the stitched gaps
+    w |= (lr == ENDLESS_CHUNK-1 ? WALL_SOUTH_BIT : 0) | (lc == ENDLESS_CHUNK-1 ? WALL_EAST_BIT : 0);
+    if(lr == ENDLESS_CHUNK-1 && lc == south_gap(cx, cy))
+        w &= ~WALL_SOUTH_BIT;
+    if(lc == ENDLESS_CHUNK-1 && lr == east_gap(cx, cy))
+        w &= ~WALL_EAST_BIT;
+
+    return w;
+}
+
+Node ChunkWorld::cell(long long r, long long c){
+    Node node;
+    int own = walls(r, c);
+
+    if(!(walls(r-1, c) & WALL_SOUTH_BIT))
+        node.path(NORTH);
+    if(!(walls(r, c-1) & WALL_EAST_BIT))
+        node.path(WEST);
+    if(!(own & WALL_SOUTH_BIT))
+        node.path(SOUTH);
+    if(!(own & WALL_EAST_BIT))
+        node.path(EAST);
+
+    return node;
+}
+
+void ChunkWorld::prefetch(long long r, long long c, int dr, int dc){
+    long long cy = floor_div(r, ENDLESS_CHUNK);
+    long long cx = floor_div(c, ENDLESS_CHUNK);
+
+    for(int i = -1; i<=1; i++)
+        for(int j = -1; j<=1; j++)
+            request(cx+j, cy+i);
+
+    for(int k = 2; k<=ENDLESS_LOOKAHEAD+1; k++)
+        for(int i = -1; i<=1; i++)
+            request(cx + k*dc + (dr != 0 ? i : 0), cy + k*dr + (dc != 0 ? i : 0));
+}
+
+size_t ChunkWorld::memory(){
+    return chunks.size()*(sizeof(WorldChunk) + packed_row_bytes(ENDLESS_CHUNK)*ENDLESS_CHUNK);
+}
+
+int Maze::load(ChunkWorld &world, long long r0, long long c0){
+    for(int i = 0; i<rows; i++){
+        for(int j = 0; j<columns; j++){
+            maze[i][j] = world.cell(r0+i, c0+j);
+
+            // The window edge is the edge of this maze
+            if(i == 0)
+                maze[i][j].wall(NORTH);
+            if(j == 0)
+                maze[i][j].wall(WEST);
+            if(i == rows-1)
+                maze[i][j].wall(SOUTH);
+            if(j == columns-1)
+                maze[i][j].wall(EAST);
+        }
+    }
+
+    return build_geometry();
+}
+
+#endif
@@ -0,0 +1,162 @@
+#include "defs.hpp"
+#include "game.hpp"
+#include "bench.hpp"
+
+using namespace std;
+
+/*
+    Runs the whole game loop offscreen for a fixed number of frames with scripted input and a fixed seed
+    Built against a GLFW with the OSMesa backend, so it needs no display or GPU, Mesa renders in software
+    Reports the frame times, the time of the simulation, upload and draw phases and the input to swap latency
+    The game only runs once per process, so the repetitions of bench.hpp are consecutive batches of the
+    measured frames, each batch gives one sample of every metric
+*/
+
+// Frames of scripted input between two changes of direction
+#define BENCH_STEP          60
+
+const char *bench_phases[3] = {"phase simulation", "phase upload", "phase draw"};
+
+// The player walks a square and switches the lights off and back on, the same keys on every run
+bool bench_input(long long frame, int key){
+    int moves[4] = {GLFW_KEY_D, GLFW_KEY_S, GLFW_KEY_A, GLFW_KEY_W};
+    if(key == moves[(frame/BENCH_STEP) % 4])
+        return true;
+    if(key == GLFW_KEY_K)
+        return frame % (8*BENCH_STEP) == 2*BENCH_STEP;
+    if(key == GLFW_KEY_L)
+        return frame % (8*BENCH_STEP) == 6*BENCH_STEP;
+    return false;
+}
+
+double percentile(std::vector<double> values, double p){
+    if(values.empty())
+        return 0;
+    std::sort(values.begin(), values.end());
+    int index = min((int)(p*values.size()), (int)values.size()-1);
+    return values[index];
+}
+
+int main(int argc, char **argv){
+    long long frames = 600;
+    long long warmup = 60;
+    unsigned int seed = 1;
+
+    GameOptions options;
+    BenchResults results("frame_bench", 5);
+    for(int i = 1; i<argc; i++){
+        if(results.flag(argc, argv, i))
+            continue;
+        if(strcmp(argv[i], "--frames") == 0 && i+1 < argc)
+            frames = atoll(argv[++i]);
+        if(strcmp(argv[i], "--warmup") == 0 && i+1 < argc)
+            warmup = atoll(argv[++i]);
+        if(strcmp(argv[i], "--seed") == 0 && i+1 < argc)
+            seed = strtoul(argv[++i], NULL, 10);
+        if(strcmp(argv[i], "--procedural") == 0)
+            options.procedural = true;
+        if(strcmp(argv[i], "--endless") == 0)
+            options.endless_mode = true;
+        if(strcmp(argv[i], "--threaded") == 0)
+            options.threaded = true;
+    }
+
+    // Frame times and the time of each phase, warm up frames left out
+    std::vector<double> frame_ms;
+    std::vector<double> phase_ms[3];
+    // Input to swap latency of each frame, -1 for frames without a new input
+    std::vector<double> latency_ms;
+    long long start_ns = now_ns();
+    long long current = 0;
+
+    scripted_input = [&current](int key){ return bench_input(current, key); };
+
+    options.seed = seed;
+    options.frames = warmup + frames;
+    options.finish = true;
+    options.on_frame = [&](long long frame){
+        long long end_ns = now_ns();
+        current = frame + 1;
+
+        if(frame >= warmup){
+            frame_ms.push_back((end_ns - start_ns)/1e6);
+            latency_ms.push_back(input_latency.frame_ms);
+            for(int i = 0; i<3; i++){
+                long long ns = 0;
+                for(int j = 0; j<profiler.frame_zones.size(); j++)
+                    if(strcmp(profiler.frame_zones[j].ff, bench_phases[i]) == 0)
+                        ns = profiler.frame_zones[j].ss;
+                phase_ms[i].push_back(ns/1e6);
+            }
+        }
+        start_ns = end_ns;
+    };
+
+    // The phases are read from the profiling zones
+    profiler.enable();
+    if(run_game(options) == EXT_FAIL || frame_ms.empty()){
+        printf("frame_bench: the game did not run, is OSMesa installed?\n");
+        return EXT_FAIL;
+    }
+
+    double total = 0, worst = 0;
+    for(int i = 0; i<frame_ms.size(); i++){
+        total += frame_ms[i];
+        worst = max(worst, frame_ms[i]);
+    }
+
+    printf("\n%lld frames, seed %u, %lld warm up frames\n", (long long)frame_ms.size(), seed, warmup);
+    printf("%-18s %10s %10s %10s %10s\n", "frame (ms)", "mean", "p50", "p99", "max");
+    printf("%-18s %10.3f %10.3f %10.3f %10.3f\n", "", total/frame_ms.size(), percentile(frame_ms, 0.5), percentile(frame_ms, 0.99), worst);
+
+    // Throughput is the frames per second the phase alone would allow
+    printf("\n%-18s %10s %10s %14s\n", "phase", "mean (ms)", "p99 (ms)", "frames/s");
+    for(int i = 0; i<3; i++){
+        double sum = 0;
+        for(int j = 0; j<phase_ms[i].size(); j++)
+            sum += phase_ms[i][j];
+        double mean = sum/phase_ms[i].size();
+        printf("%-18s %10.3f %10.3f %14.1f\n", bench_phases[i] + 6, mean, percentile(phase_ms[i], 0.99), mean > 0 ? 1000.0/mean : 0.0);
+    }
+
+    // Only the frames that showed a new input
+    std::vector<double> shown;
+    for(int i = 0; i<latency_ms.size(); i++)
+        if(latency_ms[i] >= 0)
+            shown.push_back(latency_ms[i]);
+    if(!shown.empty()){
+        double sum = 0;
+        for(int i = 0; i<shown.size(); i++)
+            sum += shown[i];
+        printf("\n%-18s %10s %10s %10s %10s\n", "input to swap (ms)", "mean", "p50", "p99", "inputs");
+        printf("%-18s %10.3f %10.3f %10.3f %10d\n", "", sum/shown.size(), percentile(shown, 0.5), percentile(shown, 0.99), (int)shown.size());
+    }
+
+    int batch = max((int)frame_ms.size()/results.reps, 1);
+    for(int start = 0; start + batch <= frame_ms.size(); start += batch){
+        std::vector<double> frames(frame_ms.begin() + start, frame_ms.begin() + start + batch);
+        double sum = 0;
+        for(int j = 0; j<frames.size(); j++)
+            sum += frames[j];
+        results.add("frame mean", "ms", sum/batch, true);
+        results.add("frame p99", "ms", percentile(frames, 0.99), true);
+
+        for(int i = 0; i<3; i++){
+            std::vector<double> phase(phase_ms[i].begin() + start, phase_ms[i].begin() + start + batch);
+            sum = 0;
+            for(int j = 0; j<phase.size(); j++)
+                sum += phase[j];
+            results.add((std::string(bench_phases[i]) + " mean").c_str(), "ms", sum/batch);
+            results.add((std::string(bench_phases[i]) + " p99").c_str(), "ms", percentile(phase, 0.99));
+        }
+
+        std::vector<double> latency;
+        for(int j = start; j<start + batch; j++)
+            if(latency_ms[j] >= 0)
+                latency.push_back(latency_ms[j]);
+        if(!latency.empty())
+            results.add("input latency p99", "ms", percentile(latency, 0.99), true);
+    }
+
+    return results.finish() == EXT_SUCC ? 0 : EXT_FAIL;
+}
@@ -0,0 +1,278 @@
+#include "defs.hpp"
+#include "world.hpp"
+#include "player.hpp"
+#include "graphics_setup.hpp"
+#include "joint.hpp"
+#include "jobs.hpp"
+#include "level.hpp"
+#include "wallpass.hpp"
+#include "overlay.hpp"
+#include "recorder.hpp"
+#include "simulation.hpp"
+
+#ifndef GAME_H
+#define GAME_H
+
+
+/*
+    The game loop, shared by the game and the frame benchmark
+    Each frame is split into simulation, upload and draw phase zones so their cost can be told apart
+    With threaded set the rules run on a SimThread and this loop only sends the input and draws its snapshots
+*/
+
+class GameOptions{
+public:
+    // Optional pregenerated maze file to play instead of a fresh maze
+    const char *maze_path;
+    bool endless_mode;
+    bool procedural;
+    // Chrome trace of the profiling zones written on exit
+    const char *trace_path;
+    // Frames slower than this many milliseconds dump the flight recorder, 0 leaves it off
+    double hitch_ms;
+
+    unsigned int seed;
+    // Frames to run, 0 runs until the window is closed
+    long long frames;
+    // Waits for every frame to be rendered, for contexts with nothing behind the swap
+    bool finish;
+    // Runs the simulation on its own thread, see simulation.hpp
+    bool threaded;
+    // Called at the end of every frame with its number
+    std::function<void(long long)> on_frame;
+
+    GameOptions(){
+        maze_path = NULL;
+        endless_mode = false;
+        procedural = false;
+        trace_path = NULL;
+        hitch_ms = 0;
+        seed = time(0);
+        frames = 0;
+        finish = false;
+        threaded = false;
+    }
+};
+
+// Returns EXT_FAIL when the window could not be made or --assert-steady failed
+int run_game(GameOptions &options){
+    if(options.trace_path != NULL)
+        profiler.enable();
+
+    // Keeps the last frames around and writes them out when one is too slow
+    FlightRecorder recorder;
+    if(options.hitch_ms > 0)
+        recorder.enable(options.hitch_ms);
+    recorder.maze_path = options.maze_path;
+    recorder.endless = options.endless_mode;
+
+    srand(0);
+    window = setup_graphics(shaderProgram, window);
+
+    if(window == NULL){
+        std::cout << "sid is bond sir";
+        return EXT_FAIL;
+    }
+    frame_stream.init();
+    crewmates.init();
+
+    std::pair<float, float> pos = bot_spawn();
+
+    
+    Maze world(MAZE_HEIGHT, MAZE_WIDTH, options.seed);
+    Player player;
+    Player bot;
+
+    int prev_time = (int)game_clock();
+
+    MazeFile maze_file;
+    if(options.maze_path != NULL && maze_file.map(options.maze_path) == EXT_SUCC)
+        world.load(maze_file, 0, 0);
+    else if(!options.endless_mode)
+        world.init();
+    player.init(0.0, 0.0);
+    bot.init(pos.ff, pos.ss);
+
+
+    gltInit();
+    GLTtext *text1 = gltCreateText();
+	gltSetText(text1, "Hello World!");
+
+    // Frame times, GPU passes and uploads, toggled with F3
+    PerfOverlay perf_overlay;
+    perf_overlay.init();
+
+    bool end_game = false;
+
+    // The next round's maze is generated and uploaded while this one is played
+    // Declared before the job system, which joins its workers before the pending maze is freed
+    LevelTransition transition;
+    JobSystem jobs;
+    // Endless rounds keep the same world, so there is no next maze to build
+    if(!options.endless_mode)
+        transition.prepare(jobs, world.seed + 1, world.engine);
+
+    // Endless mode streams the maze in from chunks around the player
+    ChunkWorld endless(world.seed, &jobs);
+    EndlessWindow endless_window;
+    if(options.endless_mode)
+        endless_window.init(world, endless);
+
+    // Draws the maze from a texture instead of its geometry
+    WallPass wall_pass;
+
+    // Failed by --assert-steady
+    int status = EXT_SUCC;
+
+    // Started once the maze and the crewmates are in place, stopped before the job system goes
+    SimThread sim;
+    if(options.threaded)
+        sim.start(world, player, bot, jobs, options.endless_mode);
+
+    for(long long frame = 0; !glfwWindowShouldClose(window) && (options.frames == 0 || frame < options.frames); frame++){
+        //glUseProgram(shaderProgram);
+        if(options.threaded){
+            PROFILE_ZONE("phase sync");
+            // The simulation is parked until the maze it asked for is in place
+            int request = sim.receive(world, player, bot, end_game);
+            if(request == SIM_NEXT_ROUND)
+                next_round(world, player, bot, transition, jobs);
+            else if(request == SIM_ENDLESS_ROUND)
+                next_endless_round(world, player);
+            else if(request == SIM_SHIFT)
+                endless_window.follow(world, endless, player, bot);
+            if(request != SIM_NONE)
+                sim.resume(world, player, bot);
+
+            // Sent after the request was handled, a parked simulation took an input first so there is room
+            InputState input = sample_input(window);
+            sim.send(input);
+        }
+        else{
+            PROFILE_ZONE("phase simulation");
+            InputState input = processInput(window, world, player, bot);
+            input_latency.frame(input.event_ns);
+        }
+        perf_overlay.poll(window);
+        frame_stream.begin_frame();
+        frame_upload_bytes = 0;
+        perf_overlay.begin_frame();
+
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        if(end_game){
+            game_over_message(player);
+        }
+        else{
+            {
+                PROFILE_ZONE("phase upload");
+                if(options.endless_mode)
+                    endless_window.follow(world, endless, player, bot);
+                else
+                    transition.step();
+            }
+
+            {
+                PROFILE_ZONE("phase draw");
+                perf_overlay.begin_pass(PASS_WALLS);
+                if(options.procedural)
+                    wall_pass.draw(world);
+                else
+                    world.draw(shaderProgram, window);
+                perf_overlay.end_pass();
+            }
+
+            if(!options.threaded){
+                PROFILE_ZONE("phase simulation");
+                // Both distance fields only read the maze, the pickups have to wait for the lights
+                Job *lights = jobs.add("update_lights", [&](){ world.update_lights(player.vertices, player.position); });
+                Job *visibility = jobs.add("update_bot_visibility", [&](){ update_bot_visibility(player, bot, world); });
+                Job *pickups = jobs.add("check_powerups", [&](){ check_powerups(player, world); }, {lights});
+                jobs.wait(visibility);
+                jobs.wait(pickups);
+                jobs.clear();
+
+                lights_off_score(player, world, prev_time);
+            }
+
+            {
+                PROFILE_ZONE("phase draw");
+                player.draw(shaderProgram, window);
+                bot.draw(shaderProgram, window);
+                perf_overlay.begin_pass(PASS_MARKERS);
+                frame_batch.flush(shaderProgram);
+                perf_overlay.end_pass();
+                perf_overlay.begin_pass(PASS_CREWMATES);
+                crewmates.flush();
+                perf_overlay.end_pass();
+            }
+
+            if(!options.threaded){
+                PROFILE_ZONE("phase simulation");
+                if(!bot.dead && remove_bot(player, world)){
+                    bot.kill();
+                }
+                if(activate_powerup(player, bot, world)){
+                    world.activate_powerups();
+                }
+
+                if(bot_killed_player(player, bot, world))
+                    end_game = true;
+
+                // Escaping starts the next round, running out of time ends the game
+                if(game_over(player, world)){
+                    if(world.tasks < 0 && options.endless_mode)
+                        next_endless_round(world, player);
+                    else if(world.tasks < 0)
+                        next_round(world, player, bot, transition, jobs);
+                    else
+                        end_game = true;
+                }
+            }
+
+            {
+                PROFILE_ZONE("phase draw");
+                perf_overlay.begin_pass(PASS_HUD);
+                render_hud(player, world);
+                perf_overlay.end_pass();
+            }
+        }
+        profiler.end_frame();
+        recorder.record(world, player, bot, endless_window.r0, endless_window.c0);
+        if(accounting.end_frame() == EXT_FAIL){
+            status = EXT_FAIL;
+            glfwSetWindowShouldClose(window, true);
+        }
+        // Current for endless mode too, where the walls are built again whenever the window moves
+        perf_overlay.wall_edges = world.wall_edges;
+        perf_overlay.wall_runs = world.wall_runs;
+        perf_overlay.end_frame(options.procedural ? 1 : world.visible_chunks);
+
+
+        frame_stream.end_frame();
+        {
+            PROFILE_ZONE("glfwSwapBuffers");
+            glfwSwapBuffers(window);
+            // Without a display nothing waits for the frame to be rendered
+            if(options.finish)
+                glFinish();
+        }
+        input_latency.swapped();
+        glfwPollEvents();
+
+        if(options.on_frame)
+            options.on_frame(frame);
+    }
+
+    sim.stop();
+    recorder.flush(world);
+    jobs.report();
+    if(hw_counters.enabled)
+        report_counters();
+    if(options.trace_path != NULL && profiler.write(options.trace_path) == EXT_FAIL)
+        printf("Could not write the trace to %s\n", options.trace_path);
+
+    return status;
+}
+
+#endif
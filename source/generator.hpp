@@ -0,0 +1,300 @@
+#include "defs.hpp"
+#include "world.hpp"
+
+#ifndef GENERATOR_H
+#define GENERATOR_H
+
+
+// Depth first search with an explicit stack, long winding corridors
+class Backtracker : public Generator{
+public:
+    const char *name(){ return "backtracker"; }
+    int generate(Maze&);
+};
+
+// Loop erased random walks, every spanning tree is equally likely
+class Wilson : public Generator{
+public:
+    const char *name(){ return "wilson"; }
+    int generate(Maze&);
+};
+
+// Random order over all walls with union-find, many short dead ends
+class Kruskal : public Generator{
+public:
+    std::vector<int> parent;
+
+    const char *name(){ return "kruskal"; }
+    int generate(Maze&);
+    int find(int);
+};
+
+// Splits open rooms with walls that have a single gap, long straight walls
+class Division : public Generator{
+public:
+    const char *name(){ return "division"; }
+    int generate(Maze&);
+};
+
+Generator *make_generator(int engine){
+    if(engine == GEN_BACKTRACKER)
+        return new Backtracker();
+    if(engine == GEN_WILSON)
+        return new Wilson();
+    if(engine == GEN_KRUSKAL)
+        return new Kruskal();
+    if(engine == GEN_DIVISION)
+        return new Division();
+    return NULL;
+}
+
+int Backtracker::generate(Maze &m){
+    int rows = m.rows;
+    int columns = m.columns;
+
+    // Cells are numbered row major
+    std::vector<char> vis(rows*columns, 0);
+    std::vector<int> st;
+    st.reserve(rows*columns);
+
+    int start = (m.rng() % rows)*columns + m.rng() % columns;
+    vis[start] = 1;
+    st.push_back(start);
+
+    int dir[4];
+
+    while(!st.empty()){
+        int cur = st.back();
+        int r = cur / columns;
+        int c = cur % columns;
+        int n = 0;
+
+        if(r != 0 && !vis[cur-columns])
+            dir[n++] = NORTH;
+        if(r != rows-1 && !vis[cur+columns])
+            dir[n++] = SOUTH;
+        if(c != 0 && !vis[cur-1])
+            dir[n++] = WEST;
+        if(c != columns-1 && !vis[cur+1])
+            dir[n++] = EAST;
+
+        if(n == 0){
+            st.pop_back();
+            continue;
+        }
+
+        int sel = dir[m.rng() % n];
+        m.path(r, c, sel);
+
+        int next = cur;
+        if(sel == NORTH)
+            next -= columns;
+        if(sel == SOUTH)
+            next += columns;
+        if(sel == WEST)
+            next -= 1;
+        if(sel == EAST)
+            next += 1;
+
+        vis[next] = 1;
+        st.push_back(next);
+    }
+
+    memory = vis.capacity()*sizeof(char) + st.capacity()*sizeof(int);
+    return EXT_SUCC;
+}
+
+int Wilson::generate(Maze &m){
+    int rows = m.rows;
+    int columns = m.columns;
+    int cells = rows*columns;
+
+    std::vector<char> in_tree(cells, 0);
+    // Last direction taken out of each cell during the current walk
+    std::vector<char> walk(cells, 0);
+
+    in_tree[m.rng() % cells] = 1;
+    int remaining = cells - 1;
+
+    // Walks start from cells in order, skipping the ones already in the tree
+    int start = 0;
+
+    while(remaining > 0){
+        while(in_tree[start])
+            start++;
+
+        int cur = start;
+        while(!in_tree[cur]){
+            int r = cur / columns;
+            int c = cur % columns;
+            int dir[4];
+            int n = 0;
+
+            if(r != 0)
+                dir[n++] = NORTH;
+            if(r != rows-1)
+                dir[n++] = SOUTH;
+            if(c != 0)
+                dir[n++] = WEST;
+            if(c != columns-1)
+                dir[n++] = EAST;
+
+            // Overwriting the direction erases any loop the walk made
+            walk[cur] = dir[m.rng() % n];
+
+            if(walk[cur] == NORTH)
+                cur -= columns;
+            else if(walk[cur] == SOUTH)
+                cur += columns;
+            else if(walk[cur] == WEST)
+                cur -= 1;
+            else
+                cur += 1;
+        }
+
+        // Replay the loop free walk and add it to the tree
+        cur = start;
+        while(!in_tree[cur]){
+            in_tree[cur] = 1;
+            remaining--;
+            m.path(cur / columns, cur % columns, walk[cur]);
+
+            if(walk[cur] == NORTH)
+                cur -= columns;
+            else if(walk[cur] == SOUTH)
+                cur += columns;
+            else if(walk[cur] == WEST)
+                cur -= 1;
+            else
+                cur += 1;
+        }
+    }
+
+    memory = in_tree.capacity()*sizeof(char) + walk.capacity()*sizeof(char);
+    return EXT_SUCC;
+}
+
+int Kruskal::find(int x){
+    // Path halving
+    while(parent[x] != x){
+        parent[x] = parent[parent[x]];
+        x = parent[x];
+    }
+    return x;
+}
+
+int Kruskal::generate(Maze &m){
+    int rows = m.rows;
+    int columns = m.columns;
+    int cells = rows*columns;
+
+    parent.resize(cells);
+    std::vector<int> size(cells, 1);
+    for(int i = 0; i<cells; i++)
+        parent[i] = i;
+
+    // Every inner wall once, as cell*2 for the south wall and cell*2+1 for the east wall
+    std::vector<int> walls;
+    walls.reserve(2*cells);
+    for(int i = 0; i<cells; i++){
+        if(i / columns != rows-1)
+            walls.push_back(2*i);
+        if(i % columns != columns-1)
+            walls.push_back(2*i+1);
+    }
+    std::shuffle(walls.begin(), walls.end(), m.rng);
+
+    int joined = 0;
+    for(int i = 0; i<walls.size() && joined < cells-1; i++){
+        int a = walls[i] / 2;
+        int b = (walls[i] & 1) ? a+1 : a+columns;
+
+        int ra = find(a);
+        int rb = find(b);
+        if(ra == rb)
+            continue;
+
+        // Union by size
+        if(size[ra] < size[rb])
+            std::swap(ra, rb);
+        parent[rb] = ra;
+        size[ra] += size[rb];
+        joined++;
+
+        m.path(a / columns, a % columns, (walls[i] & 1) ? EAST : SOUTH);
+    }
+
+    memory = parent.capacity()*sizeof(int) + size.capacity()*sizeof(int) + walls.capacity()*sizeof(int);
+    parent.clear();
+    parent.shrink_to_fit();
+    return EXT_SUCC;
+}
+
+int Division::generate(Maze &m){
+    int rows = m.rows;
+    int columns = m.columns;
+
+    // Start from one open room
+    for(int i = 0; i<rows; i++){
+        for(int j = 0; j<columns; j++){
+            if(i != rows-1)
+                m.path(i, j, SOUTH);
+            if(j != columns-1)
+                m.path(i, j, EAST);
+        }
+    }
+
+    // Rooms still to split as {row, column, height, width}, iterative to keep the stack flat on big mazes
+    std::vector<std::pair<std::pair<int, int>, std::pair<int, int>>> rooms;
+    rooms.push_back(std::make_pair(std::make_pair(0, 0), std::make_pair(rows, columns)));
+    size_t peak = 1;
+
+    while(!rooms.empty()){
+        std::pair<std::pair<int, int>, std::pair<int, int>> cur = rooms.back();
+        rooms.pop_back();
+
+        int r = cur.ff.ff;
+        int c = cur.ff.ss;
+        int h = cur.ss.ff;
+        int w = cur.ss.ss;
+
+        if(h < 2 && w < 2)
+            continue;
+
+        bool horizontal = h > w || (h == w && (m.rng() & 1));
+        if(w < 2)
+            horizontal = true;
+        if(h < 2)
+            horizontal = false;
+
+        if(horizontal){
+            // Wall along the south side of row split, with one gap
+            int split = r + m.rng() % (h-1);
+            int gap = c + m.rng() % w;
+            for(int j = c; j<c+w; j++)
+                if(j != gap)
+                    m.wall(split, j, SOUTH);
+
+            rooms.push_back(std::make_pair(std::make_pair(r, c), std::make_pair(split-r+1, w)));
+            rooms.push_back(std::make_pair(std::make_pair(split+1, c), std::make_pair(r+h-split-1, w)));
+        }
+        else{
+            // Wall along the east side of column split, with one gap
+            int split = c + m.rng() % (w-1);
+            int gap = r + m.rng() % h;
+            for(int i = r; i<r+h; i++)
+                if(i != gap)
+                    m.wall(i, split, EAST);
+
+            rooms.push_back(std::make_pair(std::make_pair(r, c), std::make_pair(h, split-c+1)));
+            rooms.push_back(std::make_pair(std::make_pair(r, split+1), std::make_pair(h, c+w-split-1)));
+        }
+
+        peak = max(peak, rooms.size());
+    }
+
+    memory = peak*sizeof(rooms[0]);
+    return EXT_SUCC;
+}
+
+#endif
@@ -1,6 +1,8 @@
 #include "defs.hpp"
 #include "world.hpp"
 #include "player.hpp"
+#include "profile.hpp"
+#include "input.hpp"
 
 #ifndef SHADERS_H
 #define SHADERS_H
@@ -20,6 +22,84 @@ const char *vertexShaderSource ="#version 330 core\n"
     "}\0";
 
 
+// vertex shader for the packed wall chunks, positions are whole grid units from the chunk's first corner
+const char *gridVertexShaderSource ="#version 330 core\n"
+    "layout (location = 0) in vec2 aPos;\n"
+    "layout (location = 1) in vec3 aColor;\n"
+    "uniform vec2 origin;\n"
+    "uniform vec2 cell;\n"
+    "uniform vec2 chunk;\n"
+    "uniform float units;\n"
+    "uniform mat4 view;\n"
+    "out vec3 ourColor;\n"
+    "void main()\n"
+    "{\n"
+    "   vec2 grid = chunk + aPos/units;\n"
+    "   gl_Position = view * vec4(origin.x + grid.x*cell.x, origin.y - grid.y*cell.y, 0.0, 1.0);\n"
+    "   ourColor = aColor;\n"
+    "}\0";
+
+
+// vertex shader for the shared crewmate mesh, one instance per entity
+const char *crewmateVertexShaderSource ="#version 330 core\n"
+    "layout (location = 0) in vec2 aPos;\n"
+    "layout (location = 1) in float aVisor;\n"
+    "uniform vec4 placement[" TO_STRING(CREWMATE_BATCH) "];\n"
+    "uniform vec3 body[" TO_STRING(CREWMATE_BATCH) "];\n"
+    "uniform vec3 visor[" TO_STRING(CREWMATE_BATCH) "];\n"
+    "uniform mat4 view;\n"
+    "out vec3 ourColor;\n"
+    "void main()\n"
+    "{\n"
+    "   vec4 p = placement[gl_InstanceID];\n"
+    "   gl_Position = view * vec4(aPos + p.xy, 0.0, 1.0);\n"
+    "   ourColor = mix(body[gl_InstanceID], visor[gl_InstanceID], aVisor) * p.z;\n"
+    "}\0";
+
+
+// vertex shader for crewmates drawn as one quad each, positions are in crewmate sizes from the centre
+const char *crewmateSdfVertexShaderSource ="#version 330 core\n"
+    "layout (location = 0) in vec2 aPos;\n"
+    "uniform vec4 placement[" TO_STRING(CREWMATE_BATCH) "];\n"
+    "uniform vec3 body[" TO_STRING(CREWMATE_BATCH) "];\n"
+    "uniform vec3 visor[" TO_STRING(CREWMATE_BATCH) "];\n"
+    "uniform vec2 size;\n"
+    "uniform mat4 view;\n"
+    "out vec2 local;\n"
+    "flat out vec3 bodyColor;\n"
+    "flat out vec3 visorColor;\n"
+    "void main()\n"
+    "{\n"
+    "   vec4 p = placement[gl_InstanceID];\n"
+    "   gl_Position = view * vec4(aPos*size + p.xy, 0.0, 1.0);\n"
+    "   local = aPos;\n"
+    "   bodyColor = body[gl_InstanceID] * p.z;\n"
+    "   visorColor = visor[gl_InstanceID] * p.z;\n"
+    "}\0";
+
+// Body, dome and visor of the crewmate as distance fields, the same shapes the mesh is made of
+const char *crewmateSdfFragmentShaderSource = "#version 330 core\n"
+    "out vec4 FragColor;\n"
+    "in vec2 local;\n"
+    "flat in vec3 bodyColor;\n"
+    "flat in vec3 visorColor;\n"
+    "float box(vec2 p, vec2 c, vec2 b){\n"
+    "   vec2 d = abs(p - c) - b;\n"
+    "   return length(max(d, 0.0)) + min(max(d.x, d.y), 0.0);\n"
+    "}\n"
+    "void main()\n"
+    "{\n"
+    "   float dome = max(length(local - vec2(0.0, 0.5)) - 0.5, 0.5 - local.y);\n"
+    "   float shape = min(box(local, vec2(0.0), vec2(0.5)), dome);\n"
+    "   float visor = box(local, vec2(0.0, 0.5), vec2(1.0/3.0, 0.25));\n"
+    "   float aa = fwidth(local.x);\n"
+    "   float inside = 1.0 - smoothstep(-aa, aa, shape);\n"
+    "   float on_visor = 1.0 - smoothstep(-aa, aa, visor);\n"
+    "   if(max(inside, on_visor) <= 0.0) discard;\n"
+    "   FragColor = vec4(mix(bodyColor, visorColor, on_visor), max(inside, on_visor));\n"
+    "}\n\0";
+
+
 // fragment shader
 const char *fragmentShaderSource = "#version 330 core\n"
     "out vec4 FragColor;\n"
@@ -33,6 +113,52 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height){
     glViewport(0, 0, width, height);
 }
 
+// Compiles and links a shader program, 0 if any stage fails
+unsigned int build_program(const char *vertexSource, const char *fragmentSource){
+    // vertex shader
+    unsigned int vertexShader = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(vertexShader, 1, &vertexSource, NULL);
+    glCompileShader(vertexShader);
+    // check for shader compile errors
+    int success;
+    char infoLog[512];
+    glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
+    if (!success)
+    {
+        glGetShaderInfoLog(vertexShader, 512, NULL, infoLog);
+        std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
+        return 0;
+    }
+    // fragment shader
+    unsigned int fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(fragmentShader, 1, &fragmentSource, NULL);
+    glCompileShader(fragmentShader);
+    // check for shader compile errors
+    glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
+    if (!success)
+    {
+        glGetShaderInfoLog(fragmentShader, 512, NULL, infoLog);
+        std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
+        return 0;
+    }
+    // link shaders
+    unsigned int program = glCreateProgram();
+    glAttachShader(program, vertexShader);
+    glAttachShader(program, fragmentShader);
+    glLinkProgram(program);
+    // check for linking errors
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success) {
+        glGetProgramInfoLog(program, 512, NULL, infoLog);
+        std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+        return 0;
+    }
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+
+    return program;
+}
+
 GLFWwindow *setup_graphics(unsigned int &shaderProgram, GLFWwindow *window){
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
@@ -54,6 +180,7 @@ GLFWwindow *setup_graphics(unsigned int &shaderProgram, GLFWwindow *window){
     }
     glfwMakeContextCurrent(window);
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+    glfwSetKeyCallback(window, key_callback);
    
 
     // glad: load all OpenGL function pointers connect to opengl implementaion from driver
@@ -66,46 +193,21 @@ GLFWwindow *setup_graphics(unsigned int &shaderProgram, GLFWwindow *window){
 
     // build and compile our shader program
     // ------------------------------------
-    // vertex shader
-    unsigned int vertexShader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertexShader, 1, &vertexShaderSource, NULL);
-    glCompileShader(vertexShader);
-    // check for shader compile errors
-    int success;
-    char infoLog[512];
-    glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
-    if (!success)
-    {
-        glGetShaderInfoLog(vertexShader, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
+    shaderProgram = build_program(vertexShaderSource, fragmentShaderSource);
+    if(shaderProgram == 0)
         return NULL;
-    }
-    // fragment shader
-    unsigned int fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragmentShader, 1, &fragmentShaderSource, NULL);
-    glCompileShader(fragmentShader);
-    // check for shader compile errors
-    glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
-    if (!success)
-    {
-        glGetShaderInfoLog(fragmentShader, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
+
+    grid_shader = build_program(gridVertexShaderSource, fragmentShaderSource);
+    if(grid_shader == 0)
         return NULL;
-    }
-    // link shaders
-    shaderProgram = glCreateProgram();
-    glAttachShader(shaderProgram, vertexShader);
-    glAttachShader(shaderProgram, fragmentShader);
-    glLinkProgram(shaderProgram);
-    // check for linking errors
-    glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
-    if (!success) {
-        glGetProgramInfoLog(shaderProgram, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+
+    crewmate_shader = build_program(crewmateVertexShaderSource, fragmentShaderSource);
+    if(crewmate_shader == 0)
+        return NULL;
+
+    crewmate_sdf_shader = build_program(crewmateSdfVertexShaderSource, crewmateSdfFragmentShaderSource);
+    if(crewmate_sdf_shader == 0)
         return NULL;
-    }
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
 
     glm::mat4 projection = glm::ortho(0.0f, 1920.0f, 0.0f, 1080.0f);
     unsigned int projectionLoc = glGetUniformLocation(shaderProgram, "projection");
@@ -115,44 +217,48 @@ GLFWwindow *setup_graphics(unsigned int &shaderProgram, GLFWwindow *window){
     return window;
 }
 
-void processInput(GLFWwindow *window, Maze &world, Player &player, Player &bot){
-    if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
-        glfwSetWindowShouldClose(window, true);
+// Moves the player and the camera with it, flips the lights and moves the bot one step along its path
+void apply_input(InputState &input, Maze &world, Player &player, Player &bot, glm::vec3 &camera){
+    input_events.applied.store(input.tick, std::memory_order_relaxed);
 
     float x_speed = 5.0/SCR_WIDTH;
     float y_speed = 5.0/SCR_HEIGHT;
 
-    if(glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS){
+    if(input.active(INPUT_NORTH)){
         int ret = player.move(NORTH, y_speed, world);
         if(ret == EXT_SUCC)
-            cameraPos += y_speed * cameraUp;
+            camera += y_speed * cameraUp;
     }
 
-    if(glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS){
+    if(input.active(INPUT_SOUTH)){
         int ret = player.move(SOUTH, y_speed, world);
         if(ret == EXT_SUCC)
-            cameraPos -= y_speed * cameraUp;
+            camera -= y_speed * cameraUp;
     }
 
-    if(glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS){
+    if(input.active(INPUT_EAST)){
         int ret = player.move(EAST, x_speed, world);
         if(ret == EXT_SUCC)
-            cameraPos += x_speed * cameraRight;
+            camera += x_speed * cameraRight;
     }
 
-    if(glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS){
+    if(input.active(INPUT_WEST)){
         int ret = player.move(WEST, x_speed, world);
         if(ret == EXT_SUCC)
-            cameraPos -= x_speed * cameraRight;
+            camera -= x_speed * cameraRight;
     }
 
-    if(glfwGetKey(window, GLFW_KEY_L) == GLFW_PRESS){
+    if(input.active(INPUT_LIGHTS_ON)){
         world.lights_on();
     }
-    if(glfwGetKey(window, GLFW_KEY_K) == GLFW_PRESS){
+    if(input.active(INPUT_LIGHTS_OFF)){
         world.lights_off();
     }
 
+    // A bot left outside the endless window has no path until it is placed again
+    if(!world.contains(bot.vertices, bot.position))
+        return;
+
     int bot_move = world.shortest_path(bot.vertices, bot.position, player.vertices, player.position);
     if(bot_move == NORTH || bot_move == SOUTH)
         bot.move(bot_move, y_speed, world);
@@ -160,4 +266,12 @@ void processInput(GLFWwindow *window, Maze &world, Player &player, Player &bot){
         bot.move(bot_move, x_speed, world);
 }
 
+// Returns the input it applied, its event time is where the frame's latency starts
+InputState processInput(GLFWwindow *window, Maze &world, Player &player, Player &bot){
+    PROFILE_ZONE("processInput");
+    InputState input = sample_input(window);
+    apply_input(input, world, player, bot, cameraPos);
+    return input;
+}
+
 #endif
\ No newline at end of file
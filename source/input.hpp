@@ -0,0 +1,293 @@
+#include "defs.hpp"
+#include "jobs.hpp"
+
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <atomic>
+
+
+/*
+    Keyboard input as timestamped events
+    GLFW's key callback pushes every press and release of the game's keys into a queue while glfwPollEvents runs,
+    so a tap that goes down and up between two frames is still seen. Each tick drains the queue into an InputState
+    that also carries the time of its oldest event, and InputLatency measures from there to the swap that shows it
+    The drained events can be written to a file and played back on a later run, both count game time in ticks
+    instead of seconds so the replay's round timer and score run exactly as they did in the recording
+*/
+
+// Keys the simulation reads, in the order of input_keys
+#define INPUT_NORTH          0
+#define INPUT_SOUTH          1
+#define INPUT_EAST           2
+#define INPUT_WEST           3
+#define INPUT_LIGHTS_ON      4
+#define INPUT_LIGHTS_OFF     5
+#define NUM_INPUTS           6
+
+// Events that can wait between two ticks, more than a frame's worth of key changes is dropped
+#define EVENT_QUEUE        256
+// Input to swap latencies kept for the percentiles
+#define LATENCY_SAMPLES    512
+// Ticks per second of game time while input is recorded or replayed
+#define TICK_RATE           60
+
+const int input_keys[NUM_INPUTS] = {GLFW_KEY_W, GLFW_KEY_S, GLFW_KEY_D, GLFW_KEY_A, GLFW_KEY_L, GLFW_KEY_K};
+
+// Keys held down when the input is scripted, such as by the frame benchmark, the keyboard is read when it is empty
+std::function<bool(int)> scripted_input;
+
+bool key_pressed(GLFWwindow *window, int key){
+    if(scripted_input)
+        return scripted_input(key);
+    return glfwGetKey(window, key) == GLFW_PRESS;
+}
+
+// Index in input_keys, -1 for keys the game does not use
+int input_index(int key){
+    for(int i = 0; i<NUM_INPUTS; i++)
+        if(input_keys[i] == key)
+            return i;
+    return -1;
+}
+
+class InputEvent{
+public:
+    int input;
+    bool down;
+    long long time_ns;
+};
+
+// What one tick of the simulation sees
+class InputState{
+public:
+    bool held[NUM_INPUTS];
+    // Went down since the last tick, even if they were let go again
+    bool pressed[NUM_INPUTS];
+    // Oldest event of the tick, 0 when nothing changed
+    long long event_ns;
+    long long tick;
+
+    InputState(){
+        for(int i = 0; i<NUM_INPUTS; i++)
+            held[i] = pressed[i] = false;
+        event_ns = 0;
+        tick = 0;
+    }
+
+    bool active(int i){
+        return held[i] || pressed[i];
+    }
+};
+
+class InputEvents{
+public:
+    // Single producer single consumer, the key callback writes and the tick reads
+    InputEvent events[EVENT_QUEUE];
+    std::atomic<long long> head;
+    std::atomic<long long> tail;
+    long long dropped;
+
+    // State after the events drained so far, and the ticks drained
+    bool held[NUM_INPUTS];
+    long long ticks;
+
+    // Every drained event is written here as "tick input down"
+    FILE *record_file;
+    const char *record_path;
+    // Events of a recorded run, {tick, {input, down}}, played back at the same ticks
+    std::vector<std::pair<long long, std::pair<int, int>>> replay_events;
+    int replayed;
+
+    // Set by record and replay, game_clock then counts ticks
+    bool tick_clock;
+    // Tick of the input the rules applied last, written by whichever thread runs them
+    std::atomic<long long> applied;
+
+    InputEvents(){
+        head = 0;
+        tail = 0;
+        dropped = 0;
+        for(int i = 0; i<NUM_INPUTS; i++)
+            held[i] = false;
+        ticks = 0;
+        record_file = NULL;
+        record_path = NULL;
+        replayed = 0;
+        tick_clock = false;
+        applied = 0;
+    }
+
+    ~InputEvents(){
+        if(record_file != NULL)
+            fclose(record_file);
+    }
+
+    int push(int, bool);
+    // Turns the events since the last tick into its InputState
+    InputState drain();
+
+    int record(const char*);
+    int replay(const char*);
+};
+
+int InputEvents::push(int input, bool down){
+    long long t = tail.load(std::memory_order_relaxed);
+    if(t - head.load(std::memory_order_acquire) == EVENT_QUEUE){
+        dropped++;
+        return EXT_FAIL;
+    }
+
+    InputEvent &event = events[t % EVENT_QUEUE];
+    event.input = input;
+    event.down = down;
+    event.time_ns = now_ns();
+    tail.store(t + 1, std::memory_order_release);
+    return EXT_SUCC;
+}
+
+InputState InputEvents::drain(){
+    InputState state;
+
+    long long h = head.load(std::memory_order_relaxed);
+    long long t = tail.load(std::memory_order_acquire);
+    for(; h<t; h++){
+        InputEvent &event = events[h % EVENT_QUEUE];
+        if(event.down)
+            state.pressed[event.input] = true;
+        held[event.input] = event.down;
+        if(state.event_ns == 0)
+            state.event_ns = event.time_ns;
+        if(record_file != NULL)
+            fprintf(record_file, "%lld %d %d\n", ticks, event.input, event.down ? 1 : 0);
+    }
+    head.store(h, std::memory_order_release);
+
+    for(int i = 0; i<NUM_INPUTS; i++)
+        state.held[i] = held[i];
+    state.tick = ticks;
+    ticks++;
+    return state;
+}
+
+int InputEvents::record(const char *path){
+    record_file = fopen(path, "w");
+    record_path = path;
+    tick_clock = true;
+    return record_file == NULL ? EXT_FAIL : EXT_SUCC;
+}
+
+int InputEvents::replay(const char *path){
+    FILE *in = fopen(path, "r");
+    if(in == NULL)
+        return EXT_FAIL;
+
+    long long tick;
+    int input, down;
+    while(fscanf(in, "%lld %d %d", &tick, &input, &down) == 3)
+        if(input >= 0 && input < NUM_INPUTS)
+            replay_events.push_back(std::make_pair(tick, std::make_pair(input, down)));
+    fclose(in);
+
+    replayed = 0;
+    tick_clock = true;
+    return EXT_SUCC;
+}
+
+// Shared by the key callback and the game loop
+InputEvents input_events;
+
+// Seconds the round timer and the score count in
+double game_clock(){
+    if(input_events.tick_clock)
+        return input_events.applied.load(std::memory_order_relaxed)/(double)TICK_RATE;
+    return glfwGetTime();
+}
+
+void key_callback(GLFWwindow*, int key, int, int action, int){
+    // Repeats of a held key change nothing
+    if(action == GLFW_REPEAT)
+        return;
+    int input = input_index(key);
+    if(input != -1 && !scripted_input && input_events.replay_events.empty())
+        input_events.push(input, action == GLFW_PRESS);
+}
+
+// Drains the events for the next tick, scripted and replayed input go through the queue like real keys
+InputState sample_input(GLFWwindow *window){
+    if (key_pressed(window, GLFW_KEY_ESCAPE))
+        glfwSetWindowShouldClose(window, true);
+
+    if(scripted_input){
+        for(int i = 0; i<NUM_INPUTS; i++){
+            bool down = scripted_input(input_keys[i]);
+            if(down != input_events.held[i])
+                input_events.push(i, down);
+        }
+    }
+
+    std::vector<std::pair<long long, std::pair<int, int>>> &replay = input_events.replay_events;
+    while(input_events.replayed < replay.size() && replay[input_events.replayed].ff <= input_events.ticks){
+        input_events.push(replay[input_events.replayed].ss.ff, replay[input_events.replayed].ss.ss == 1);
+        input_events.replayed++;
+    }
+
+    return input_events.drain();
+}
+
+/*
+    Time from the oldest input a frame responds to until glfwSwapBuffers returned for that frame
+    GLFW only hands out events inside glfwPollEvents, so the clock starts when the event is delivered
+*/
+class InputLatency{
+public:
+    // Oldest input of the frame being drawn, 0 when it responds to none
+    long long shown_ns;
+    // Latency of the last frame that showed an input, -1 for frames that showed none
+    double frame_ms;
+
+    double samples[LATENCY_SAMPLES];
+    long long count;
+
+    InputLatency(){
+        shown_ns = 0;
+        frame_ms = -1;
+        count = 0;
+    }
+
+    // Called with the input the frame responds to, and once its swap returned
+    void frame(long long);
+    void swapped();
+    // Over the last LATENCY_SAMPLES inputs
+    double percentile(double);
+};
+
+void InputLatency::frame(long long event_ns){
+    shown_ns = event_ns;
+}
+
+void InputLatency::swapped(){
+    frame_ms = -1;
+    if(shown_ns == 0)
+        return;
+
+    frame_ms = (now_ns() - shown_ns)/1e6;
+    samples[count % LATENCY_SAMPLES] = frame_ms;
+    count++;
+    shown_ns = 0;
+}
+
+double InputLatency::percentile(double p){
+    int n = min(count, (long long)LATENCY_SAMPLES);
+    if(n == 0)
+        return 0;
+    std::vector<double> sorted(samples, samples + n);
+    std::sort(sorted.begin(), sorted.end());
+    int index = min((int)(p*n), n-1);
+    return sorted[index];
+}
+
+// Shared by the game loop and the overlay
+InputLatency input_latency;
+
+#endif
@@ -0,0 +1,327 @@
+#include "defs.hpp"
+
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <chrono>
+
+
+long long now_ns(){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class Job{
+public:
+    const char *name;
+    std::function<void()> func;
+
+    // Dependencies that have not finished yet, the job is queued once this reaches 0
+    std::atomic<int> pending;
+    // Set last, once nothing touches the job anymore
+    std::atomic<bool> done;
+
+    std::mutex lock;
+    bool finished;
+    std::vector<Job*> dependents;
+
+    // Long running jobs only picked up by worker threads, never by a waiting main thread
+    bool background;
+
+    int worker;
+    long long start_ns;
+    long long end_ns;
+
+    Job(const char *n, std::function<void()> f){
+        name = n;
+        func = f;
+        pending = 0;
+        done = false;
+        finished = false;
+        background = false;
+        worker = -1;
+        start_ns = 0;
+        end_ns = 0;
+    }
+};
+
+// Per thread queue, the owner works on the back while thieves take from the front
+class JobQueue{
+public:
+    std::mutex lock;
+    std::deque<Job*> jobs;
+
+    void push(Job*);
+    Job *pop();
+    Job *steal();
+};
+
+void JobQueue::push(Job *job){
+    std::lock_guard<std::mutex> guard(lock);
+    jobs.push_back(job);
+}
+
+Job *JobQueue::pop(){
+    std::lock_guard<std::mutex> guard(lock);
+    if(jobs.empty())
+        return NULL;
+    Job *job = jobs.back();
+    jobs.pop_back();
+    return job;
+}
+
+Job *JobQueue::steal(){
+    std::lock_guard<std::mutex> guard(lock);
+    if(jobs.empty())
+        return NULL;
+    Job *job = jobs.front();
+    jobs.pop_front();
+    return job;
+}
+
+class JobSystem{
+public:
+    int num_workers;
+
+    // One queue per worker, the last one belongs to the thread that owns the system
+    std::vector<JobQueue*> queues;
+    JobQueue background_queue;
+    std::vector<std::thread> threads;
+
+    std::atomic<int> queued;
+    std::atomic<bool> quit;
+    std::mutex sleep_lock;
+    std::condition_variable wake;
+
+    std::mutex owned_lock;
+    std::vector<Job*> owned;
+
+    // Accumulated time per job name, {count, total ns}
+    std::mutex stats_lock;
+    std::map<std::string, std::pair<long long, long long>> stats;
+
+    JobSystem(int workers = 0){
+        num_workers = workers;
+        if(num_workers <= 0)
+            num_workers = (int)std::thread::hardware_concurrency() - 1;
+        if(num_workers < 0)
+            num_workers = 0;
+
+        for(int i = 0; i<=num_workers; i++)
+            queues.push_back(new JobQueue());
+
+        queued = 0;
+        quit = false;
+
+        for(int i = 0; i<num_workers; i++)
+            threads.push_back(std::thread(&JobSystem::worker_loop, this, i));
+    }
+
+    ~JobSystem(){
+        {
+            std::lock_guard<std::mutex> guard(sleep_lock);
+            quit = true;
+        }
+        wake.notify_all();
+        for(int i = 0; i<threads.size(); i++)
+            threads[i].join();
+        for(int i = 0; i<owned.size(); i++)
+            delete owned[i];
+        for(int i = 0; i<queues.size(); i++)
+            delete queues[i];
+    }
+
+    // Adds a job that runs once all of its dependencies are done
+    Job *add(const char*, std::function<void()>, std::vector<Job*> deps = std::vector<Job*>());
+    // Adds a job that may span several frames, such as generating the next level
+    Job *add_background(const char*, std::function<void()>);
+    // Splits [begin, end) into chunks of grain and returns a job that finishes with all of them
+    Job *parallel_for(const char*, int, int, int, std::function<void(int, int)>);
+
+    void wait(Job*);
+    void wait_all();
+    // Frees every job that is done, jobs still in flight are kept
+    void clear();
+    void report();
+
+    int worker_index();
+    void worker_loop(int);
+    bool run_one(int);
+    void submit(Job*);
+    void finish(Job*);
+};
+
+int &current_worker(){
+    static thread_local int index = -1;
+    return index;
+}
+
+int JobSystem::worker_index(){
+    if(current_worker() == -1)
+        return num_workers;
+    return current_worker();
+}
+
+Job *JobSystem::add(const char *name, std::function<void()> func, std::vector<Job*> deps){
+    Job *job = new Job(name, func);
+
+    {
+        std::lock_guard<std::mutex> guard(owned_lock);
+        owned.push_back(job);
+    }
+
+    // Hold an extra count so that dependencies finishing meanwhile cannot queue the job early
+    job->pending = 1;
+    for(int i = 0; i<deps.size(); i++){
+        std::lock_guard<std::mutex> guard(deps[i]->lock);
+        if(deps[i]->finished)
+            continue;
+        job->pending++;
+        deps[i]->dependents.push_back(job);
+    }
+
+    if(--job->pending == 0)
+        submit(job);
+
+    return job;
+}
+
+Job *JobSystem::add_background(const char *name, std::function<void()> func){
+    Job *job = new Job(name, func);
+    job->background = true;
+
+    {
+        std::lock_guard<std::mutex> guard(owned_lock);
+        owned.push_back(job);
+    }
+
+    submit(job);
+    return job;
+}
+
+Job *JobSystem::parallel_for(const char *name, int begin, int end, int grain, std::function<void(int, int)> func){
+    std::vector<Job*> parts;
+    if(grain <= 0)
+        grain = 1;
+
+    for(int i = begin; i<end; i+=grain){
+        int last = min(i+grain, end);
+        parts.push_back(add(name, [func, i, last](){ func(i, last); }));
+    }
+
+    return add(name, [](){}, parts);
+}
+
+void JobSystem::submit(Job *job){
+    if(job->background)
+        background_queue.push(job);
+    else
+        queues[worker_index()]->push(job);
+    {
+        std::lock_guard<std::mutex> guard(sleep_lock);
+        queued++;
+    }
+    wake.notify_one();
+}
+
+void JobSystem::finish(Job *job){
+    std::vector<Job*> ready;
+    {
+        std::lock_guard<std::mutex> guard(job->lock);
+        job->finished = true;
+        for(int i = 0; i<job->dependents.size(); i++)
+            if(--job->dependents[i]->pending == 0)
+                ready.push_back(job->dependents[i]);
+    }
+    job->done = true;
+
+    for(int i = 0; i<ready.size(); i++)
+        submit(ready[i]);
+}
+
+bool JobSystem::run_one(int index){
+    Job *job = queues[index]->pop();
+
+    for(int i = 1; job == NULL && i<queues.size(); i++)
+        job = queues[(index+i) % queues.size()]->steal();
+
+    // Without workers the owning thread has to run background jobs itself
+    if(job == NULL && (index < num_workers || num_workers == 0))
+        job = background_queue.steal();
+
+    if(job == NULL)
+        return false;
+
+    queued--;
+
+    job->worker = index;
+    job->start_ns = now_ns();
+    job->func();
+    job->end_ns = now_ns();
+
+    {
+        std::lock_guard<std::mutex> guard(stats_lock);
+        std::pair<long long, long long> &cur = stats[job->name];
+        cur.ff += 1;
+        cur.ss += job->end_ns - job->start_ns;
+    }
+
+    finish(job);
+    return true;
+}
+
+void JobSystem::worker_loop(int index){
+    current_worker() = index;
+
+    while(!quit){
+        if(run_one(index))
+            continue;
+
+        std::unique_lock<std::mutex> guard(sleep_lock);
+        wake.wait(guard, [this](){ return quit || queued > 0; });
+    }
+}
+
+void JobSystem::wait(Job *job){
+    // Help out instead of blocking so waiting on the main thread never idles a core
+    while(!job->done){
+        if(!run_one(worker_index()))
+            std::this_thread::yield();
+    }
+}
+
+void JobSystem::wait_all(){
+    std::vector<Job*> jobs;
+    {
+        std::lock_guard<std::mutex> guard(owned_lock);
+        jobs = owned;
+    }
+    for(int i = 0; i<jobs.size(); i++)
+        wait(jobs[i]);
+}
+
+void JobSystem::clear(){
+    std::lock_guard<std::mutex> guard(owned_lock);
+    std::vector<Job*> running;
+    for(int i = 0; i<owned.size(); i++){
+        if(owned[i]->done)
+            delete owned[i];
+        else
+            running.push_back(owned[i]);
+    }
+    owned = running;
+}
+
+void JobSystem::report(){
+    std::lock_guard<std::mutex> guard(stats_lock);
+    printf("%-28s %10s %14s %12s\n", "job", "count", "total (ms)", "avg (us)");
+    for(auto it = stats.begin(); it != stats.end(); it++){
+        printf("%-28s %10lld %14.3f %12.3f\n", it->ff.c_str(), it->ss.ff, it->ss.ss/1e6, it->ss.ss/1e3/it->ss.ff);
+    }
+}
+
+#endif
@@ -1,24 +1,25 @@
 #include "defs.hpp"
 #include "world.hpp"
 #include "player.hpp"
+#include "profile.hpp"
+#include "input.hpp"
+
+#ifndef JOINT_H
+#define JOINT_H
 
 int update_bot_visibility(Player &player, Player &bot, Maze& world){
+    PROFILE_ZONE("update_bot_visibility");
+    bot.body = glm::vec3(0.86f, 0.08f, 0.24f);
+    bot.visor = glm::vec3(0.90f, 0.91f, 0.98f);
+
     if(world.lights){
-        for(int i = 0; i<24; i+=6){
-            bot.vertices[i+3] = 0.86f;
-            bot.vertices[i+4] = 0.08f;
-            bot.vertices[i+5] = 0.24f;
-        }
-        for(int i = 24; i<48; i+=6){
-            bot.vertices[i+3] = 0.9000f;
-            bot.vertices[i+4] =  0.9100f;
-            bot.vertices[i+5] =  0.9800f;
-        }
-        for(int i = 48; i<bot.vertices.size(); i+=6){
-            bot.vertices[i+3] = 0.86f;
-            bot.vertices[i+4] = 0.08f;
-            bot.vertices[i+5] = 0.24f;
-        }
+        bot.tint = 1.0f;
+        return EXT_SUCC;
+    }
+
+    // Outside the window it is too far away to be seen
+    if(!world.contains(bot.vertices, bot.position)){
+        bot.tint = 0.0f;
         return EXT_SUCC;
     }
 
@@ -91,24 +92,14 @@ int update_bot_visibility(Player &player, Player &bot, Maze& world){
     scale = min(scale, dist[bot_bounds.ss.ss][bot_bounds.ff.ff]);
     scale = min(scale, dist[bot_bounds.ss.ss][bot_bounds.ff.ss]);
     
-    for(int i = 0; i<24; i+=6){
-            bot.vertices[i+3] = max(0.0, 0.86*(1.0 - GRADIENT*scale));
-            bot.vertices[i+4] = max(0.0, 0.08*(1.0 - GRADIENT*scale));
-            bot.vertices[i+5] = max(0.0, 0.24*(1.0 - GRADIENT*scale));
-        }
-    for(int i = 24; i<48; i+=6){
-            bot.vertices[i+3] = max(0.0, 0.90*(1.0 - GRADIENT*scale));
-            bot.vertices[i+4] = max(0.0, 0.91*(1.0 - GRADIENT*scale));
-            bot.vertices[i+5] = max(0.0, 0.98*(1.0 - GRADIENT*scale));
-        }
-    for(int i = 48; i<bot.vertices.size(); i+=6){
-            bot.vertices[i+3] = max(0.0, 0.86*(1.0 - GRADIENT*scale));
-            bot.vertices[i+4] = max(0.0, 0.08*(1.0 - GRADIENT*scale));
-            bot.vertices[i+5] = max(0.0, 0.24*(1.0 - GRADIENT*scale));
-        }
+    // Fades out the further the bot is from the player through the maze
+    bot.tint = max(0.0, 1.0 - GRADIENT*scale);
+
+    return EXT_SUCC;
 }
 
 bool remove_bot(Player &player, Maze &world){
+    PROFILE_ZONE("remove_bot");
     std::pair<std::pair<int, int>, std::pair<int, int>> bounds = world.get_bounds(player.vertices, player.position);
     if(bounds.ff.ff == world.bot_kill.ff && bounds.ff.ss == world.bot_kill.ff)
         if(bounds.ss.ff == world.bot_kill.ss && bounds.ss.ss == world.bot_kill.ss){
@@ -121,6 +112,7 @@ bool remove_bot(Player &player, Maze &world){
 }
 
 bool bot_killed_player(Player &player, Player &bot, Maze &world){
+    PROFILE_ZONE("bot_killed_player");
     if(bot.dead)
         return false;
     std::pair<std::pair<int, int>, std::pair<int, int>> pbounds = world.get_bounds(player.vertices, player.position);
@@ -132,6 +124,7 @@ bool bot_killed_player(Player &player, Player &bot, Maze &world){
 }
 
 bool activate_powerup(Player &player, Player &bot, Maze &world){
+    PROFILE_ZONE("activate_powerup");
     if(world.powerup_activated == true)
         return false;
     std::pair<std::pair<int, int>, std::pair<int, int>> bounds = world.get_bounds(player.vertices, player.position);
@@ -146,7 +139,8 @@ bool activate_powerup(Player &player, Player &bot, Maze &world){
 }
 
 bool game_over(Player &player, Maze &world){
-    if(player.time -(int)glfwGetTime() <= 0)
+    PROFILE_ZONE("game_over");
+    if(player.time -(int)game_clock() <= 0)
         return true;
     if(world.tasks != 0)
         return false;
@@ -163,6 +157,7 @@ bool game_over(Player &player, Maze &world){
 }
 
 void check_powerups(Player &player, Maze &world){
+    PROFILE_ZONE("check_powerups");
     std::pair<std::pair<int, int>, std::pair<int, int>> bounds = world.get_bounds(player.vertices, player.position);
 
     std::vector<int> to_remove;
@@ -191,16 +186,18 @@ void check_powerups(Player &player, Maze &world){
 }
 
 void lights_off_score(Player &player, Maze &world, int &prev_time){
-    if(player.time - (int)glfwGetTime() != player.time - prev_time){
+    PROFILE_ZONE("lights_off_score");
+    if(player.time - (int)game_clock() != player.time - prev_time){
         if(world.lights == false)
             player.score += 2;
-        prev_time = (int)glfwGetTime();
+        prev_time = (int)game_clock();
     }
 }
 
 void render_hud(Player &player, Maze &world){
-    GLTtext *text1 = gltCreateText();
-	gltSetText(text1, "Hello World!");
+    PROFILE_ZONE("render_hud");
+    // Made once, a new text every frame leaked its buffers
+    static GLTtext *text1 = gltCreateText();
     char str[50];
 
     gltBeginDraw();
@@ -224,7 +221,7 @@ void render_hud(Player &player, Maze &world){
     gltDrawText2D(text1, 10.0f, 90.0f, 2.0f);
 
     gltColor(1.0f, 1.0f, 1.0f, 1.0f);
-    sprintf(str, "Time: %d", player.time - (int)glfwGetTime());
+    sprintf(str, "Time: %d", player.time - (int)game_clock());
     gltSetText(text1, str);
     gltDrawText2D(text1, 10.0f, 130.0f, 2.0f);
 
@@ -234,8 +231,7 @@ void render_hud(Player &player, Maze &world){
 
 
 void game_over_message(Player &player){
-    GLTtext *text1 = gltCreateText();
-	gltSetText(text1, "Hello World!");
+    static GLTtext *text1 = gltCreateText();
     char str[50];
 
     gltBeginDraw();
@@ -256,4 +252,6 @@ void game_over_message(Player &player){
 			3.0f,
 			GLT_CENTER, GLT_CENTER);
     gltEndDraw();   
-}
\ No newline at end of file
+}
+
+#endif
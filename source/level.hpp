@@ -0,0 +1,207 @@
+#include "defs.hpp"
+#include "world.hpp"
+#include "player.hpp"
+#include "jobs.hpp"
+#include "endless.hpp"
+#include "input.hpp"
+
+#ifndef LEVEL_H
+#define LEVEL_H
+
+
+// Builds the next round's maze on a worker while the current one is played
+class LevelTransition{
+public:
+    Maze *next;
+    // Set by the generation job, which is freed by the job system once it is done
+    std::atomic<bool> generated;
+
+    LevelTransition(){
+        next = NULL;
+        generated = false;
+    }
+    // The job system has to be gone first, so a generation job is no longer running
+    ~LevelTransition(){
+        if(next != NULL){
+            next->release();
+            delete next;
+        }
+    }
+
+    // Starts generating a maze with the given seed and engine in the background
+    int prepare(JobSystem&, unsigned int, int);
+    // Pushes a slice of the generated geometry to the GPU, called once per frame
+    int step();
+    // Hands over the prepared maze, finishing any remaining work first
+    Maze *take(JobSystem&);
+};
+
+int LevelTransition::prepare(JobSystem &jobs, unsigned int seed, int engine){
+    if(next != NULL)
+        return EXT_FAIL;
+
+    next = new Maze(MAZE_HEIGHT, MAZE_WIDTH, seed, engine);
+    generated = false;
+
+    Maze *maze = next;
+    jobs.add_background("generate_next_maze", [this, maze](){
+        maze->init();
+        generated = true;
+    });
+
+    return EXT_SUCC;
+}
+
+int LevelTransition::step(){
+    if(next == NULL || !generated)
+        return EXT_FAIL;
+
+    return next->upload(UPLOAD_BUDGET);
+}
+
+Maze *LevelTransition::take(JobSystem &jobs){
+    if(next == NULL)
+        return NULL;
+
+    while(!generated){
+        if(!jobs.run_one(jobs.worker_index()))
+            std::this_thread::yield();
+    }
+    while(next->upload(UPLOAD_BUDGET) != EXT_SUCC);
+
+    Maze *ret = next;
+    next = NULL;
+    return ret;
+}
+
+// Random starting point for the impostor, away from the player's column
+std::pair<float, float> bot_spawn(){
+    int x = rand() % MAZE_WIDTH;
+    int y = rand() % MAZE_HEIGHT;
+    while(x == MAZE_WIDTH/2){
+        x = rand() % MAZE_WIDTH;
+    }
+
+    return {-width*((float)x-(float)MAZE_WIDTH/2-0.5), height*((float)y - (float)MAZE_HEIGHT/2-0.5)};
+}
+
+// Cells the player may get to the window edge before it moves in endless mode
+#define ENDLESS_MARGIN        4
+
+// Window of the endless world that is currently loaded into the maze
+class EndlessWindow{
+public:
+    long long r0;
+    long long c0;
+    // Last player cell, used to tell the direction of travel
+    long long prev_r;
+    long long prev_c;
+
+    EndlessWindow(){
+        r0 = -MAZE_HEIGHT/2;
+        c0 = -MAZE_WIDTH/2;
+        prev_r = 0;
+        prev_c = 0;
+    }
+
+    int init(Maze&, ChunkWorld&);
+    // Prefetches ahead of the player and moves the window once they get close to its edge
+    int follow(Maze&, ChunkWorld&, Player&, Player&);
+};
+
+int EndlessWindow::init(Maze &world, ChunkWorld &endless){
+    world.place_markers();
+    return world.load(endless, r0, c0);
+}
+
+// True once the player is close enough to the edge of the window for it to move
+bool endless_at_edge(Maze &world, Player &player){
+    std::pair<std::pair<int, int>, std::pair<int, int>> bounds = world.get_bounds(player.vertices, player.position);
+    if(bounds.ff.ff >= ENDLESS_MARGIN && bounds.ff.ss < world.columns-ENDLESS_MARGIN)
+        if(bounds.ss.ff >= ENDLESS_MARGIN && bounds.ss.ss < world.rows-ENDLESS_MARGIN)
+            return false;
+    return true;
+}
+
+int EndlessWindow::follow(Maze &world, ChunkWorld &endless, Player &player, Player &bot){
+    std::pair<std::pair<int, int>, std::pair<int, int>> bounds = world.get_bounds(player.vertices, player.position);
+    long long r = r0 + bounds.ss.ff;
+    long long c = c0 + bounds.ff.ff;
+
+    int dr = (r > prev_r) - (r < prev_r);
+    int dc = (c > prev_c) - (c < prev_c);
+    prev_r = r;
+    prev_c = c;
+
+    endless.prefetch(r, c, dr, dc);
+
+    if(!endless_at_edge(world, player))
+        return EXT_FAIL;
+
+    // Recentre on the player, everything on screen moves back by the same amount
+    int shift_r = bounds.ss.ff - world.rows/2;
+    int shift_c = bounds.ff.ff - world.columns/2;
+    r0 += shift_r;
+    c0 += shift_c;
+
+    world.shift_markers(shift_r, shift_c);
+    world.release();
+    world.load(endless, r0, c0);
+
+    glm::vec3 offset = glm::vec3(-shift_c*width, shift_r*height, 0.0f);
+    player.position += offset;
+    bot.position += offset;
+    cameraPos += offset;
+
+    // A bot the window left behind comes back somewhere inside it
+    if(!bot.dead && !world.contains(bot.vertices, bot.position)){
+        std::pair<float, float> pos = bot_spawn();
+        bot = Player();
+        bot.init(pos.ff, pos.ss);
+    }
+
+    return EXT_SUCC;
+}
+
+// New markers in the current window, the endless world itself stays as it is
+int next_endless_round(Maze &world, Player &player){
+    world.tasks = 2;
+    world.powerup_activated = false;
+    world.powerup_pos.clear();
+    world.powerups_vertices.clear();
+    world.powerups_indices.clear();
+    world.place_markers();
+
+    player.time = TIME_LIMIT + (int)game_clock();
+
+    // The walls stay the same, so the uploaded chunks are kept
+    return world.build_markers();
+}
+
+// Swaps in the prepared maze and resets everything that belongs to a round
+int next_round(Maze &world, Player &player, Player &bot, LevelTransition &transition, JobSystem &jobs){
+    Maze *next = transition.take(jobs);
+    if(next == NULL)
+        return EXT_FAIL;
+
+    bool lights = world.lights;
+
+    world.release();
+    world = std::move(*next);
+    delete next;
+
+    world.lights = lights;
+    transition.prepare(jobs, world.seed + 1, world.engine);
+
+    player.position = glm::vec3(0.0f, 0.0f, 0.0f);
+    player.time = TIME_LIMIT + (int)game_clock();
+    cameraPos = glm::vec3(0.0, 0.0, 1.0);
+
+    std::pair<float, float> pos = bot_spawn();
+    bot = Player();
+    bot.init(pos.ff, pos.ss);
+
+    return EXT_SUCC;
+}
+
+#endif
@@ -0,0 +1,320 @@
+#include "defs.hpp"
+#include "world.hpp"
+#include "jobs.hpp"
+#include "bench.hpp"
+
+#include <sys/resource.h>
+#include <functional>
+#include <cmath>
+
+using namespace std;
+
+/*
+    Benchmarks the maze generators, or with --scaling sweeps the maze size and the number of impostors and
+    reports how generation, the impostors' path finding, the lighting, the memory and the simulation part
+    of a frame grow, as an exponent fitted over the sweep
+    The generator times and the per call cost of the world functions the game runs every tick are kept as
+    bench.hpp metrics, so they can be written out and compared against a baseline
+*/
+
+// Largest side and impostor count of the scaling sweep, both can be lowered from the command line
+#define SCALING_MAX_SIDE      8192
+#define SCALING_MAX_IMPOSTORS 4096
+// Side of the maze the impostor sweep runs on
+#define SCALING_IMPOSTOR_SIDE 128
+// A measurement is repeated until it took this long, and the best run is kept
+#define SCALING_BUDGET_NS     200000000LL
+#define SCALING_MAX_RUNS      50
+
+// Side of the maze the tracked world functions run on
+#define TRACKED_SIDE          128
+// Each sample of a tracked function is its mean over a batch of calls that took this long
+#define TRACKED_BATCH_NS      50000000LL
+
+// Peak resident memory of the process in MB
+double peak_rss(){
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss/1024.0;
+}
+
+// Best time of a few runs in ns
+long long best_ns(std::function<void()> run){
+    long long best = -1, total = 0;
+    for(int i = 0; i<SCALING_MAX_RUNS && (i == 0 || total < SCALING_BUDGET_NS); i++){
+        long long start = now_ns();
+        run();
+        long long elapsed = now_ns() - start;
+        total += elapsed;
+        if(best == -1 || elapsed < best)
+            best = elapsed;
+    }
+    return best;
+}
+
+// Slope of log(y) over log(x) by least squares, y grows like x to that power
+double fit_exponent(std::vector<double> &x, std::vector<double> &y){
+    double n = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for(int i = 0; i<x.size(); i++){
+        if(x[i] <= 0 || y[i] <= 0)
+            continue;
+        double lx = log(x[i]), ly = log(y[i]);
+        n++;
+        sx += lx;
+        sy += ly;
+        sxx += lx*lx;
+        sxy += lx*ly;
+    }
+    if(n < 2 || n*sxx - sx*sx == 0)
+        return 0;
+    return (n*sxy - sx*sy)/(n*sxx - sx*sx);
+}
+
+// Square outline a bit smaller than a cell, laid out like the crewmate vertices
+std::vector<float> cell_hull(){
+    float width = (float)CELL_WIDTH/SCR_WIDTH*0.3f;
+    float height = (float)CELL_WIDTH/SCR_HEIGHT*0.3f;
+    return {-width, -height, 0, 0, 0, 0,
+             width, -height, 0, 0, 0, 0,
+             width,  height, 0, 0, 0, 0,
+            -width,  height, 0, 0, 0, 0};
+}
+
+// Position of the center of a cell, the same way get_bounds maps it back
+glm::vec3 cell_position(Maze &maze, int r, int c){
+    float width = (float)CELL_WIDTH/SCR_WIDTH;
+    float height = (float)CELL_WIDTH/SCR_HEIGHT;
+    return glm::vec3(-width*maze.columns/2 + (c+0.5f)*width, height*maze.rows/2 - (r+0.5f)*height, 0.0f);
+}
+
+class ScalingPoint{
+public:
+    double x;
+    double generation_ms;
+    // Per tick of the simulation
+    double ai_us;
+    double lights_us;
+    double frame_us;
+    double memory_mb;
+};
+
+/*
+    One point of the sweep: generates a maze, places the impostors on random cells and the player in the middle
+    A tick is what the game does on the CPU each frame the player changes cell, the lights are off so they are
+    computed again, and every impostor looks for its path to the player
+*/
+ScalingPoint scaling_point(int side, int impostors){
+    ScalingPoint point;
+    std::vector<float> hull = cell_hull();
+
+    Maze maze(side, side, 1234);
+    Generator *generator = make_generator(GEN_BACKTRACKER);
+    long long start = now_ns();
+    generator->generate(maze);
+    maze.carve_loops();
+    point.generation_ms = (now_ns() - start)/1e6;
+    delete generator;
+
+    std::mt19937 rng(side + impostors);
+    std::vector<glm::vec3> bots;
+    for(int i = 0; i<impostors; i++)
+        bots.push_back(cell_position(maze, rng() % side, rng() % side));
+
+    // The player steps between two cells so the lighting never hits its cache
+    glm::vec3 player[2] = {cell_position(maze, side/2, side/2), cell_position(maze, side/2, side/2 + 1)};
+    int step = 0;
+    maze.lights = false;
+
+    point.lights_us = best_ns([&](){
+        maze.update_lights(hull, player[step++ % 2]);
+    })/1e3;
+
+    point.ai_us = best_ns([&](){
+        for(int i = 0; i<bots.size(); i++)
+            maze.shortest_path(hull, bots[i], hull, player[0]);
+    })/1e3;
+
+    point.frame_us = best_ns([&](){
+        maze.update_lights(hull, player[step++ % 2]);
+        for(int i = 0; i<bots.size(); i++)
+            maze.shortest_path(hull, bots[i], hull, player[0]);
+    })/1e3;
+
+    // The grid and light distances the maze keeps, and the distance grid each path search allocates
+    double grid = (double)side*(sizeof(std::vector<Node>) + side*sizeof(Node));
+    double lights = (double)maze.light_dist.capacity()*sizeof(maze.light_dist[0]);
+    double scratch = (double)side*(sizeof(std::vector<int>) + side*sizeof(int));
+    point.memory_mb = (grid + lights + scratch)/(1024.0*1024.0);
+    return point;
+}
+
+// Prints the exponent of each column over the sweep, and over its last two points where the growth shows first
+void print_exponents(std::vector<ScalingPoint> &points, const char *over){
+    const char *names[5] = {"generation", "ai tick", "lighting", "frame", "memory"};
+    std::vector<double> x, y[5];
+    for(int i = 0; i<points.size(); i++){
+        x.push_back(points[i].x);
+        y[0].push_back(points[i].generation_ms);
+        y[1].push_back(points[i].ai_us);
+        y[2].push_back(points[i].lights_us);
+        y[3].push_back(points[i].frame_us);
+        y[4].push_back(points[i].memory_mb);
+    }
+
+    printf("\n%-12s %12s %12s    (time or memory ~ %s^exponent)\n", "subsystem", "exponent", "last step", over);
+    int worst = -1;
+    double worst_exponent = 0;
+    for(int i = 0; i<5; i++){
+        double exponent = fit_exponent(x, y[i]);
+        int n = x.size();
+        std::vector<double> tail_x(x.begin() + max(n-2, 0), x.end()), tail_y(y[i].begin() + max(n-2, 0), y[i].end());
+        printf("%-12s %12.2f %12.2f\n", names[i], exponent, fit_exponent(tail_x, tail_y));
+        if(i < 4 && exponent > worst_exponent){
+            worst = i;
+            worst_exponent = exponent;
+        }
+    }
+    if(worst != -1)
+        printf("Scales worst: %s\n", names[worst]);
+}
+
+int scaling(int max_side, int max_impostors){
+    std::vector<ScalingPoint> points;
+
+    printf("Maze size, 1 impostor\n");
+    printf("%8s %12s %12s %12s %12s %12s %10s\n", "side", "cells", "gen ms", "ai us", "lights us", "frame us", "memory MB");
+    for(int side = 25; side <= max_side; side = (side == 25 ? 64 : side*2)){
+        ScalingPoint point = scaling_point(side, 1);
+        point.x = (double)side*side;
+        points.push_back(point);
+        printf("%8d %12.0f %12.3f %12.1f %12.1f %12.1f %10.1f\n", side, point.x, point.generation_ms, point.ai_us, point.lights_us, point.frame_us, point.memory_mb);
+        fflush(stdout);
+    }
+    print_exponents(points, "cells");
+
+    points.clear();
+    printf("\nImpostors, %dx%d maze\n", SCALING_IMPOSTOR_SIDE, SCALING_IMPOSTOR_SIDE);
+    printf("%8s %12s %12s %12s %12s %12s %10s\n", "impostors", "", "gen ms", "ai us", "lights us", "frame us", "memory MB");
+    for(int impostors = 1; impostors <= max_impostors; impostors *= 4){
+        ScalingPoint point = scaling_point(SCALING_IMPOSTOR_SIDE, impostors);
+        point.x = impostors;
+        points.push_back(point);
+        printf("%8d %12s %12.3f %12.1f %12.1f %12.1f %10.1f\n", impostors, "", point.generation_ms, point.ai_us, point.lights_us, point.frame_us, point.memory_mb);
+        fflush(stdout);
+    }
+    print_exponents(points, "impostors");
+
+    return EXT_SUCC;
+}
+
+// Mean time of one call in ns over a batch of calls
+double batch_ns(std::function<void()> run){
+    long long start = now_ns(), elapsed = 0, calls = 0;
+    do{
+        run();
+        calls++;
+        elapsed = now_ns() - start;
+    } while(elapsed < TRACKED_BATCH_NS);
+    return (double)elapsed/calls;
+}
+
+// The world functions each tick pays for, one sample per repetition, all of them tracked
+void track_world(BenchResults &results){
+    std::vector<float> hull = cell_hull();
+
+    Maze maze(TRACKED_SIDE, TRACKED_SIDE, 1234);
+    Generator *generator = make_generator(GEN_BACKTRACKER);
+    generator->generate(maze);
+    maze.carve_loops();
+    delete generator;
+
+    glm::vec3 bot = cell_position(maze, 0, 0);
+    glm::vec3 player[2] = {cell_position(maze, TRACKED_SIDE/2, TRACKED_SIDE/2), cell_position(maze, TRACKED_SIDE/2, TRACKED_SIDE/2 + 1)};
+    int step = 0;
+    maze.lights = false;
+
+    for(int rep = 0; rep<results.reps; rep++){
+        results.add("shortest_path", "ns/op", batch_ns([&](){
+            maze.shortest_path(hull, bot, hull, player[0]);
+        }), true);
+        // Moves between two cells so every call computes the lights again
+        results.add("update_lights", "ns/op", batch_ns([&](){
+            maze.update_lights(hull, player[step++ % 2]);
+        }), true);
+        results.add("can_move", "ns/op", batch_ns([&](){
+            maze.can_move(hull, player[0], NORTH + step++ % 4);
+        }), true);
+    }
+
+    printf("\n%dx%d maze, %d repetitions\n", TRACKED_SIDE, TRACKED_SIDE, results.reps);
+    printf("%-16s %14s %12s\n", "function", "ns/op", "95% +-");
+    for(int i = 0; i<results.metrics.size(); i++){
+        BenchMetric &metric = results.metrics[i];
+        if(metric.tracked)
+            printf("%-16s %14.1f %12.1f\n", metric.name.c_str(), metric.mean(), metric.ci95());
+    }
+}
+
+int main(int argc, char **argv){
+    if(argc > 1 && strcmp(argv[1], "--scaling") == 0){
+        int max_side = SCALING_MAX_SIDE;
+        int max_impostors = SCALING_MAX_IMPOSTORS;
+        for(int i = 2; i<argc; i++){
+            if(strcmp(argv[i], "--max-side") == 0 && i+1 < argc)
+                max_side = atoi(argv[++i]);
+            if(strcmp(argv[i], "--max-impostors") == 0 && i+1 < argc)
+                max_impostors = atoi(argv[++i]);
+        }
+        scaling(max_side, max_impostors);
+        return 0;
+    }
+
+    std::vector<int> sizes = {25, 256, 1024, 2048};
+    BenchResults results("maze_bench", 3);
+
+    // Optional list of side lengths to run instead of the defaults
+    std::vector<int> chosen;
+    for(int i = 1; i<argc; i++)
+        if(!results.flag(argc, argv, i))
+            chosen.push_back(atoi(argv[i]));
+    if(!chosen.empty())
+        sizes = chosen;
+
+    printf("%-12s %8s %10s %14s %10s %12s %10s\n", "engine", "side", "ms", "cells/s", "grid MB", "scratch MB", "rss MB");
+
+    for(int engine = 0; engine<NUM_GENERATORS; engine++){
+        for(int k = 0; k<sizes.size(); k++){
+            int side = sizes[k];
+            long long best = -1;
+            size_t scratch = 0;
+            const char *name = "";
+
+            for(int rep = 0; rep<results.reps; rep++){
+                Maze maze(side, side, 1234+rep, engine);
+                Generator *generator = make_generator(engine);
+                name = generator->name();
+
+                long long start = now_ns();
+                generator->generate(maze);
+                maze.carve_loops();
+                long long elapsed = now_ns() - start;
+
+                if(best == -1 || elapsed < best)
+                    best = elapsed;
+                scratch = generator->memory;
+                delete generator;
+
+                results.add(("generate " + std::string(name) + " " + std::to_string(side)).c_str(), "ms", elapsed/1e6);
+            }
+
+            double cells = (double)side*side;
+            double grid = cells*sizeof(Node)/(1024.0*1024.0);
+
+            printf("%-12s %8d %10.3f %14.0f %10.2f %12.2f %10.1f\n", name, side, best/1e6, cells/(best/1e9), grid, scratch/(1024.0*1024.0), peak_rss());
+        }
+    }
+
+    track_world(results);
+
+    return results.finish() == EXT_SUCC ? 0 : EXT_FAIL;
+}
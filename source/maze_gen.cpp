@@ -0,0 +1,73 @@
+#include "defs.hpp"
+#include "world.hpp"
+#include "stream.hpp"
+#include "mazefile.hpp"
+#include "jobs.hpp"
+
+#include <sys/resource.h>
+
+using namespace std;
+
+int main(int argc, char **argv){
+    // With --chunked the output is a chunked maze file that the game can map, otherwise plain packed rows
+    bool chunked = false;
+    std::vector<char*> args;
+    for(int i = 1; i<argc; i++){
+        if(strcmp(argv[i], "--chunked") == 0)
+            chunked = true;
+        else
+            args.push_back(argv[i]);
+    }
+
+    if(args.size() < 3){
+        printf("usage: %s [--chunked] <rows> <columns> <out> [seed]\n", argv[0]);
+        return 1;
+    }
+
+    long long rows = atoll(args[0]);
+    long long columns = atoll(args[1]);
+    unsigned int seed = args.size() > 3 ? strtoul(args[3], NULL, 10) : time(0);
+
+    FILE *out = fopen(args[2], "wb");
+    if(out == NULL){
+        printf("could not open %s\n", args[2]);
+        return 1;
+    }
+
+    // Large stdio buffer so the rows go out in big writes
+    std::vector<char> buffer(1 << 22);
+    setvbuf(out, &buffer[0], _IOFBF, buffer.size());
+
+    EllerStream stream(rows, columns, seed);
+    RowFile file(out);
+    ChunkWriter chunks(out);
+
+    // The game plays the top left corner of the file, so its tiles go there
+    std::mt19937 rng(seed);
+    for(unsigned int type = MARKER_END; type<=MARKER_POWERUP; type++)
+        chunks.add_marker(chunks.markers, type, rng() % min(rows, (long long)MAZE_HEIGHT), rng() % min(columns, (long long)MAZE_WIDTH));
+
+    long long start = now_ns();
+    int ret;
+    if(chunked)
+        ret = stream.generate(chunks);
+    else
+        ret = stream.generate(file);
+    long long elapsed = now_ns() - start;
+
+    fclose(out);
+
+    if(ret == EXT_FAIL){
+        printf("failed to write %s\n", args[2]);
+        return 1;
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    double cells = (double)rows*columns;
+    printf("%lld x %lld cells in %.3f s, %.1f Mcells/s\n", rows, columns, elapsed/1e9, cells/(elapsed/1e3));
+    printf("generator state %.2f MB, peak rss %.1f MB\n", stream.memory()/(1024.0*1024.0), usage.ru_maxrss/1024.0);
+
+    return 0;
+}
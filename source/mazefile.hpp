@@ -0,0 +1,445 @@
+#include "defs.hpp"
+#include "world.hpp"
+#include "stream.hpp"
+
+#ifndef MAZEFILE_H
+#define MAZEFILE_H
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+/*
+    Chunked maze file
+    [header, padded to a page] [chunks] [chunk index] [marker table] [pickup table]
+    A chunk covers CHUNK_CELLS x CHUNK_CELLS cells in the packed wall format of stream.hpp,
+    which makes every chunk exactly one 4 KB page that can be mapped in on its own
+*/
+
+#define CHUNK_CELLS       128
+#define CHUNK_ROW_BYTES   (CHUNK_CELLS/4)
+#define CHUNK_BYTES       (CHUNK_ROW_BYTES*CHUNK_CELLS)
+#define FILE_DATA_START   4096
+
+#define MARKER_END          0
+#define MARKER_BOT_KILL     1
+#define MARKER_POWERUP      2
+
+struct MazeFileHeader{
+    char magic[4];
+    unsigned int version;
+    unsigned int seed;
+    unsigned int chunk_size;
+    unsigned long long rows;
+    unsigned long long columns;
+    unsigned long long chunks_x;
+    unsigned long long chunks_y;
+    unsigned long long index_offset;
+    unsigned long long marker_offset;
+    unsigned long long marker_count;
+    unsigned long long pickup_offset;
+    unsigned long long pickup_count;
+};
+
+// Entry of the marker and pickup tables, type is a MARKER_ constant or the pickup kind
+struct MazeMarker{
+    unsigned int type;
+    unsigned int reserved;
+    unsigned long long row;
+    unsigned long long column;
+};
+
+// Collects a band of CHUNK_CELLS rows and writes it out as chunks, so memory stays O(columns)
+class ChunkWriter : public RowSink{
+public:
+    FILE *out;
+    MazeFileHeader header;
+    std::vector<unsigned char> band;
+    size_t row_bytes;
+
+    std::vector<MazeMarker> markers;
+    std::vector<MazeMarker> pickups;
+
+    ChunkWriter(FILE *f){
+        out = f;
+        row_bytes = 0;
+        memset(&header, 0, sizeof(header));
+    }
+
+    int begin(unsigned long long, unsigned long long, unsigned int);
+    int row(unsigned long long, const unsigned char*);
+    int end();
+
+    int flush_band();
+    void add_marker(std::vector<MazeMarker>&, unsigned int, unsigned long long, unsigned long long);
+};
+
+int ChunkWriter::begin(unsigned long long rows, unsigned long long columns, unsigned int seed){
+    memcpy(header.magic, "AMZC", 4);
+    header.version = 1;
+    header.seed = seed;
+    header.chunk_size = CHUNK_CELLS;
+    header.rows = rows;
+    header.columns = columns;
+    header.chunks_x = (columns + CHUNK_CELLS - 1)/CHUNK_CELLS;
+    header.chunks_y = (rows + CHUNK_CELLS - 1)/CHUNK_CELLS;
+
+    row_bytes = packed_row_bytes(columns);
+    band.assign(header.chunks_x*CHUNK_BYTES, 0xff);
+
+    // The header is written again once the table offsets are known
+    std::vector<char> page(FILE_DATA_START, 0);
+    if(fwrite(&page[0], 1, page.size(), out) != page.size())
+        return EXT_FAIL;
+    return EXT_SUCC;
+}
+
+int ChunkWriter::row(unsigned long long r, const unsigned char *data){
+    size_t local = r % CHUNK_CELLS;
+
+    // A chunk row is the same 2 bit layout as a file row, so whole slices can be copied
+    for(unsigned long long cx = 0; cx<header.chunks_x; cx++){
+        size_t from = cx*CHUNK_ROW_BYTES;
+        size_t size = min((size_t)CHUNK_ROW_BYTES, row_bytes - from);
+        unsigned char *dest = &band[cx*CHUNK_BYTES + local*CHUNK_ROW_BYTES];
+
+        memcpy(dest, data + from, size);
+        // Cells past the last column keep all their walls
+        if(cx == header.chunks_x-1 && header.columns % 4)
+            dest[size-1] |= ~((1 << (2*(header.columns % 4))) - 1);
+    }
+
+    if(local == CHUNK_CELLS-1 || r == header.rows-1)
+        return flush_band();
+    return EXT_SUCC;
+}
+
+int ChunkWriter::flush_band(){
+    if(fwrite(&band[0], 1, band.size(), out) != band.size())
+        return EXT_FAIL;
+    std::fill(band.begin(), band.end(), 0xff);
+    return EXT_SUCC;
+}
+
+void ChunkWriter::add_marker(std::vector<MazeMarker> &table, unsigned int type, unsigned long long row, unsigned long long column){
+    MazeMarker marker;
+    marker.type = type;
+    marker.reserved = 0;
+    marker.row = row;
+    marker.column = column;
+    table.push_back(marker);
+}
+
+int ChunkWriter::end(){
+    unsigned long long chunks = header.chunks_x*header.chunks_y;
+    header.index_offset = FILE_DATA_START + chunks*CHUNK_BYTES;
+
+    for(unsigned long long i = 0; i<chunks; i++){
+        unsigned long long offset = FILE_DATA_START + i*CHUNK_BYTES;
+        if(fwrite(&offset, sizeof(offset), 1, out) != 1)
+            return EXT_FAIL;
+    }
+
+    header.marker_offset = header.index_offset + chunks*sizeof(unsigned long long);
+    header.marker_count = markers.size();
+    if(markers.size() && fwrite(&markers[0], sizeof(MazeMarker), markers.size(), out) != markers.size())
+        return EXT_FAIL;
+
+    header.pickup_offset = header.marker_offset + markers.size()*sizeof(MazeMarker);
+    header.pickup_count = pickups.size();
+    if(pickups.size() && fwrite(&pickups[0], sizeof(MazeMarker), pickups.size(), out) != pickups.size())
+        return EXT_FAIL;
+
+    if(fseek(out, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, out) != 1)
+        return EXT_FAIL;
+    if(fflush(out) != 0)
+        return EXT_FAIL;
+    return EXT_SUCC;
+}
+
+// Read only mapping of a maze file, chunks are paged in by the OS as they are touched
+class MazeFile{
+public:
+    int fd;
+    unsigned char *data;
+    size_t size;
+    MazeFileHeader *header;
+    unsigned long long *index;
+
+    // Chunks currently asked to stay in memory
+    std::vector<char> resident;
+    std::vector<unsigned long long> resident_list;
+
+    MazeFile(){
+        fd = -1;
+        data = NULL;
+        size = 0;
+        header = NULL;
+        index = NULL;
+    }
+
+    ~MazeFile(){
+        unmap();
+    }
+
+    int map(const char*);
+    void unmap();
+
+    // Packed south and east walls of a cell, cells outside the maze are solid
+    int walls(long long, long long);
+    Node cell(long long, long long);
+
+    // Keeps the chunks within radius chunks of a cell and lets the OS drop all others
+    int touch(long long, long long, int);
+
+    MazeMarker *markers();
+    MazeMarker *pickups();
+};
+
+int MazeFile::map(const char *path){
+    unmap();
+
+    fd = ::open(path, O_RDONLY);
+    if(fd < 0)
+        return EXT_FAIL;
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < FILE_DATA_START){
+        unmap();
+        return EXT_FAIL;
+    }
+    size = st.st_size;
+
+    void *ptr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(ptr == MAP_FAILED){
+        data = NULL;
+        unmap();
+        return EXT_FAIL;
+    }
+    data = (unsigned char*)ptr;
+
+    // Access is by chunk, read-ahead would only pull in chunks nobody asked for
+    madvise(data, size, MADV_RANDOM);
+
+    header = (MazeFileHeader*)data;
+    if(memcmp(header->magic, "AMZC", 4) != 0 || header->chunk_size != CHUNK_CELLS){
+        unmap();
+        return EXT_FAIL;
+    }
+
+    // Every table and every chunk the index points at has to lie inside the file, a truncated one is rejected here
+    if(header->chunks_x > size/CHUNK_BYTES || header->chunks_y > size/CHUNK_BYTES ||
+       header->columns > header->chunks_x*CHUNK_CELLS || header->rows > header->chunks_y*CHUNK_CELLS){
+        unmap();
+        return EXT_FAIL;
+    }
+    unsigned long long chunks = header->chunks_x*header->chunks_y;
+    if(chunks > size/CHUNK_BYTES || header->index_offset > size || chunks > (size - header->index_offset)/sizeof(unsigned long long) ||
+       header->marker_offset > size || header->marker_count > (size - header->marker_offset)/sizeof(MazeMarker) ||
+       header->pickup_offset > size || header->pickup_count > (size - header->pickup_offset)/sizeof(MazeMarker)){
+        unmap();
+        return EXT_FAIL;
+    }
+
+    index = (unsigned long long*)(data + header->index_offset);
+    for(unsigned long long i = 0; i<chunks; i++){
+        if(index[i] > size || CHUNK_BYTES > size - index[i]){
+            unmap();
+            return EXT_FAIL;
+        }
+    }
+
+    // A pickup is either kind a generated maze can spawn, 0 or 1
+    for(unsigned long long i = 0; i<header->pickup_count; i++){
+        if(pickups()[i].type > 1){
+            unmap();
+            return EXT_FAIL;
+        }
+    }
+
+    resident.assign(header->chunks_x*header->chunks_y, 0);
+    resident_list.clear();
+
+    return EXT_SUCC;
+}
+
+void MazeFile::unmap(){
+    if(data != NULL)
+        munmap(data, size);
+    if(fd >= 0)
+        ::close(fd);
+    fd = -1;
+    data = NULL;
+    size = 0;
+    header = NULL;
+    index = NULL;
+    resident.clear();
+    resident_list.clear();
+}
+
+int MazeFile::walls(long long r, long long c){
+    if(r < 0 || c < 0 || r >= (long long)header->rows || c >= (long long)header->columns)
+        return WALL_SOUTH_BIT | WALL_EAST_BIT;
+
+    unsigned long long chunk = (r / CHUNK_CELLS)*header->chunks_x + c / CHUNK_CELLS;
+    const unsigned char *base = data + index[chunk] + (r % CHUNK_CELLS)*CHUNK_ROW_BYTES;
+    return packed_walls(base, c % CHUNK_CELLS);
+}
+
+Node MazeFile::cell(long long r, long long c){
+    Node node;
+    int own = walls(r, c);
+
+    if(r > 0 && !(walls(r-1, c) & WALL_SOUTH_BIT))
+        node.path(NORTH);
+    if(c > 0 && !(walls(r, c-1) & WALL_EAST_BIT))
+        node.path(WEST);
+    if(!(own & WALL_SOUTH_BIT))
+        node.path(SOUTH);
+    if(!(own & WALL_EAST_BIT))
+        node.path(EAST);
+
+    return node;
+}
+
+int MazeFile::touch(long long r, long long c, int radius){
+    long long cy = r / CHUNK_CELLS;
+    long long cx = c / CHUNK_CELLS;
+
+    // Drop chunks that fell out of range
+    std::vector<unsigned long long> kept;
+    for(int i = 0; i<resident_list.size(); i++){
+        long long y = resident_list[i] / header->chunks_x;
+        long long x = resident_list[i] % header->chunks_x;
+        if(llabs(y-cy) <= radius && llabs(x-cx) <= radius){
+            kept.push_back(resident_list[i]);
+            continue;
+        }
+        resident[resident_list[i]] = 0;
+        madvise(data + index[resident_list[i]], CHUNK_BYTES, MADV_DONTNEED);
+    }
+    resident_list = kept;
+
+    // Ask for the new ones ahead of time
+    for(long long y = cy-radius; y<=cy+radius; y++){
+        for(long long x = cx-radius; x<=cx+radius; x++){
+            if(y < 0 || x < 0 || y >= (long long)header->chunks_y || x >= (long long)header->chunks_x)
+                continue;
+            unsigned long long chunk = y*header->chunks_x + x;
+            if(resident[chunk])
+                continue;
+            resident[chunk] = 1;
+            resident_list.push_back(chunk);
+            madvise(data + index[chunk], CHUNK_BYTES, MADV_WILLNEED);
+        }
+    }
+
+    return resident_list.size();
+}
+
+MazeMarker *MazeFile::markers(){
+    return (MazeMarker*)(data + header->marker_offset);
+}
+
+MazeMarker *MazeFile::pickups(){
+    return (MazeMarker*)(data + header->pickup_offset);
+}
+
+int Maze::save(const char *path){
+    FILE *out = fopen(path, "wb");
+    if(out == NULL)
+        return EXT_FAIL;
+
+    ChunkWriter writer(out);
+    std::vector<unsigned char> row(packed_row_bytes(columns));
+
+    int ret = writer.begin(rows, columns, seed);
+
+    for(int i = 0; i<rows && ret == EXT_SUCC; i++){
+        for(int j = 0; j<columns; j++){
+            int walls = 0;
+            if(maze[i][j].south == WALL)
+                walls |= WALL_SOUTH_BIT;
+            if(maze[i][j].east == WALL)
+                walls |= WALL_EAST_BIT;
+            pack_walls(&row[0], j, walls);
+        }
+        ret = writer.row(i, &row[0]);
+    }
+
+    // Marker cells are stored as {column, row} in the maze
+    writer.add_marker(writer.markers, MARKER_END, end.ss, end.ff);
+    writer.add_marker(writer.markers, MARKER_BOT_KILL, bot_kill.ss, bot_kill.ff);
+    writer.add_marker(writer.markers, MARKER_POWERUP, powerup.ss, powerup.ff);
+
+    for(int i = 0; i<powerup_pos.size(); i++)
+        if(powerup_pos[i].ss != -1)
+            writer.add_marker(writer.pickups, powerup_pos[i].ss, powerup_pos[i].ff.ss, powerup_pos[i].ff.ff);
+
+    if(ret == EXT_SUCC)
+        ret = writer.end();
+
+    fclose(out);
+    return ret;
+}
+
+int Maze::load(MazeFile &file, long long r0, long long c0){
+    if(file.header == NULL)
+        return EXT_FAIL;
+
+    seed = file.header->seed;
+
+    // Only the chunks under the window are brought in
+    file.touch(r0 + rows/2, c0 + columns/2, (max(rows, columns)/CHUNK_CELLS)/2 + 1);
+
+    for(int i = 0; i<rows; i++){
+        for(int j = 0; j<columns; j++){
+            maze[i][j] = file.cell(r0+i, c0+j);
+
+            // The window edge is the edge of this maze
+            if(i == 0)
+                maze[i][j].wall(NORTH);
+            if(j == 0)
+                maze[i][j].wall(WEST);
+            if(i == rows-1)
+                maze[i][j].wall(SOUTH);
+            if(j == columns-1)
+                maze[i][j].wall(EAST);
+        }
+    }
+
+    // Markers outside the window are replaced with random ones
+    place_markers();
+    MazeMarker *markers = file.markers();
+    for(int i = 0; i<file.header->marker_count; i++){
+        long long r = markers[i].row - r0;
+        long long c = markers[i].column - c0;
+        if(r < 0 || c < 0 || r >= rows || c >= columns)
+            continue;
+
+        if(markers[i].type == MARKER_END)
+            end = std::make_pair((int)c, (int)r);
+        if(markers[i].type == MARKER_BOT_KILL)
+            bot_kill = std::make_pair((int)c, (int)r);
+        if(markers[i].type == MARKER_POWERUP)
+            powerup = std::make_pair((int)c, (int)r);
+    }
+
+    // The pickups only appear once the powerup task is done, as in a generated maze
+    saved_pickups.clear();
+    MazeMarker *pickups = file.pickups();
+    for(int i = 0; i<file.header->pickup_count; i++){
+        long long r = pickups[i].row - r0;
+        long long c = pickups[i].column - c0;
+        if(r < 0 || c < 0 || r >= rows || c >= columns)
+            continue;
+
+        saved_pickups.push_back(std::make_pair(std::make_pair((int)c, (int)r), (int)pickups[i].type));
+    }
+
+    return build_geometry();
+}
+
+#endif
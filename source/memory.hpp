@@ -0,0 +1,229 @@
+#include "defs.hpp"
+#include "profile.hpp"
+
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <atomic>
+#include <new>
+
+
+/*
+    Counts every heap allocation made through new, including the ones inside the standard containers
+    Replaces the global operator new, so it is only included by the game itself
+    Each block starts with its size so the bytes still alive are known, allocations inside a profiling zone
+    are also counted against that zone
+*/
+
+// Room for the size in front of each block, keeps the block aligned for any type
+#define HEAP_HEADER         16
+
+// Frames between two checks of --assert-steady, the first window is the warm up
+#define ACCOUNT_WINDOW     600
+// Live heap blocks a window may gain and still count as steady
+#define ACCOUNT_HEAP_SLACK 256
+// Seconds between two lines of --account
+#define ACCOUNT_LOG_SECONDS  5
+
+// Since the start
+std::atomic<long long> heap_allocations(0);
+std::atomic<long long> heap_bytes(0);
+// Alive right now
+std::atomic<long long> heap_live_blocks(0);
+std::atomic<long long> heap_live_bytes(0);
+
+void *heap_allocate(size_t size){
+    unsigned char *block = (unsigned char*)malloc(size + HEAP_HEADER);
+    if(block == NULL)
+        return NULL;
+    *(size_t*)block = size;
+
+    heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    heap_bytes.fetch_add(size, std::memory_order_relaxed);
+    heap_live_blocks.fetch_add(1, std::memory_order_relaxed);
+    heap_live_bytes.fetch_add(size, std::memory_order_relaxed);
+
+    ZoneSite *site = current_site;
+    if(site != NULL){
+        site->allocations.fetch_add(1, std::memory_order_relaxed);
+        site->bytes.fetch_add(size, std::memory_order_relaxed);
+    }
+
+    return block + HEAP_HEADER;
+}
+
+void heap_free(void *ptr){
+    if(ptr == NULL)
+        return;
+    unsigned char *block = (unsigned char*)ptr - HEAP_HEADER;
+
+    heap_live_blocks.fetch_sub(1, std::memory_order_relaxed);
+    heap_live_bytes.fetch_sub(*(size_t*)block, std::memory_order_relaxed);
+    free(block);
+}
+
+// Every form of new and delete goes through the pair above, a block from one form must be freed by the others
+void *operator new(size_t size){
+    void *ptr = heap_allocate(size);
+    if(ptr == NULL)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void *operator new[](size_t size){
+    return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t&) noexcept{
+    return heap_allocate(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t&) noexcept{
+    return heap_allocate(size);
+}
+
+void operator delete(void *ptr) noexcept{
+    heap_free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept{
+    heap_free(ptr);
+}
+
+void operator delete(void *ptr, const std::nothrow_t&) noexcept{
+    heap_free(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t&) noexcept{
+    heap_free(ptr);
+}
+
+/*
+    Per frame view of the counters above and of the GL objects in resources.hpp
+    Logs a line every ACCOUNT_LOG_SECONDS with --account, and with --assert-steady fails once a window of
+    frames ends with more GL objects or noticeably more heap blocks alive than the one before
+*/
+class Accounting{
+public:
+    bool log;
+    bool assert_steady;
+    double last_log;
+    long long frame;
+
+    // Over the last frame
+    long long allocations;
+    long long bytes;
+    long long uploaded;
+    long long site_allocations[PROFILE_SITES];
+    long long site_bytes[PROFILE_SITES];
+
+    // Totals at the end of the previous frame
+    long long last_allocations;
+    long long last_bytes;
+    long long last_site_allocations[PROFILE_SITES];
+    long long last_site_bytes[PROFILE_SITES];
+
+    // Alive at the end of the last window
+    long long window_gl[NUM_GL_RESOURCES];
+    long long window_blocks;
+
+    Accounting(){
+        log = false;
+        assert_steady = false;
+        last_log = 0;
+        frame = 0;
+        allocations = bytes = uploaded = 0;
+        last_allocations = last_bytes = 0;
+        for(int i = 0; i<PROFILE_SITES; i++){
+            site_allocations[i] = site_bytes[i] = 0;
+            last_site_allocations[i] = last_site_bytes[i] = 0;
+        }
+        for(int i = 0; i<NUM_GL_RESOURCES; i++)
+            window_gl[i] = 0;
+        window_blocks = 0;
+    }
+
+    // Called once per frame after everything was drawn, EXT_FAIL when the steady check failed
+    int end_frame();
+    int check_window();
+    void print();
+};
+
+int Accounting::end_frame(){
+    frame++;
+
+    long long total = heap_allocations.load(std::memory_order_relaxed);
+    long long total_bytes = heap_bytes.load(std::memory_order_relaxed);
+    allocations = total - last_allocations;
+    bytes = total_bytes - last_bytes;
+    last_allocations = total;
+    last_bytes = total_bytes;
+    uploaded = frame_upload_bytes;
+
+    int sites = min(num_zone_sites.load(), PROFILE_SITES);
+    for(int i = 0; i<sites; i++){
+        ZoneSite *site = zone_sites[i];
+        if(site == NULL)
+            continue;
+        long long count = site->allocations.load(std::memory_order_relaxed);
+        long long size = site->bytes.load(std::memory_order_relaxed);
+        site_allocations[i] = count - last_site_allocations[i];
+        site_bytes[i] = size - last_site_bytes[i];
+        last_site_allocations[i] = count;
+        last_site_bytes[i] = size;
+    }
+
+    if(log && glfwGetTime() - last_log >= ACCOUNT_LOG_SECONDS){
+        last_log = glfwGetTime();
+        print();
+    }
+
+    if(frame % ACCOUNT_WINDOW != 0)
+        return EXT_SUCC;
+    return check_window();
+}
+
+int Accounting::check_window(){
+    int ret = EXT_SUCC;
+    long long blocks = heap_live_blocks.load(std::memory_order_relaxed);
+
+    // The first window only sets where the steady state starts
+    if(assert_steady && frame > ACCOUNT_WINDOW){
+        for(int i = 0; i<NUM_GL_RESOURCES; i++){
+            if(gl_live[i] > window_gl[i]){
+                printf("Steady state broken: %s went from %lld to %lld over %d frames\n", gl_resource_names[i], window_gl[i], gl_live[i], ACCOUNT_WINDOW);
+                ret = EXT_FAIL;
+            }
+        }
+        if(blocks > window_blocks + ACCOUNT_HEAP_SLACK){
+            printf("Steady state broken: live heap blocks went from %lld to %lld over %d frames\n", window_blocks, blocks, ACCOUNT_WINDOW);
+            ret = EXT_FAIL;
+        }
+    }
+
+    for(int i = 0; i<NUM_GL_RESOURCES; i++)
+        window_gl[i] = gl_live[i];
+    window_blocks = blocks;
+
+    return ret;
+}
+
+void Accounting::print(){
+    printf("Frame %lld: %lld allocations (%.1f KB), heap %.2f MB in %lld blocks, uploaded %.1f KB, GL",
+           frame, allocations, bytes/1024.0, heap_live_bytes.load()/1048576.0, heap_live_blocks.load(), uploaded/1024.0);
+    for(int i = 0; i<NUM_GL_RESOURCES; i++)
+        printf(" %s %lld", gl_resource_names[i], gl_live[i]);
+    printf("\n");
+
+    int sites = min(num_zone_sites.load(), PROFILE_SITES);
+    for(int i = 0; i<sites; i++){
+        ZoneSite *site = zone_sites[i];
+        if(site != NULL && site_allocations[i] > 0)
+            printf("    %-24s %8lld allocations %10.1f KB\n", site->name, site_allocations[i], site_bytes[i]/1024.0);
+    }
+}
+
+// Shared by the game loop and the overlay
+Accounting accounting;
+
+#endif
@@ -0,0 +1,263 @@
+#include "defs.hpp"
+#include "batch.hpp"
+#include "crewmate.hpp"
+#include "profile.hpp"
+#include "memory.hpp"
+#include "input.hpp"
+
+#ifndef OVERLAY_H
+#define OVERLAY_H
+
+
+/*
+    Performance overlay toggled with F3
+    Shows a graph of the last frame times, the CPU time of every profiling zone, the GPU time of each pass,
+    the draw calls and the bytes sent to the GPU, enough to tell whether a slow frame was simulation, upload or GPU
+    GPU times come from GL_TIME_ELAPSED queries that are read OVERLAY_LATENCY frames later, so reading them
+    never waits for the GPU
+*/
+
+// Frames shown in the graph
+#define OVERLAY_FRAMES     120
+// Frames a query set is kept before its results are read
+#define OVERLAY_LATENCY      4
+
+#define PASS_WALLS           0
+#define PASS_MARKERS         1
+#define PASS_CREWMATES       2
+#define PASS_HUD             3
+#define NUM_PASSES           4
+
+// Part of ARB_timer_query, core since 3.3
+#ifndef GL_TIME_ELAPSED
+#define GL_TIME_ELAPSED     0x88BF
+#endif
+
+const char *pass_names[NUM_PASSES] = {"walls", "markers", "crewmates", "hud"};
+
+class PerfOverlay{
+public:
+    bool visible;
+    // F3 was down last frame, the overlay flips once per press
+    bool key_down;
+
+    unsigned int queries[OVERLAY_LATENCY][NUM_PASSES];
+    bool issued[OVERLAY_LATENCY][NUM_PASSES];
+    int frame;
+    // Pass being timed, -1 when none
+    int pass;
+
+    // Milliseconds, the GPU ones are OVERLAY_LATENCY frames old
+    float frame_ms[OVERLAY_FRAMES];
+    double gpu_ms[NUM_PASSES];
+    double frame_start;
+
+    int draw_calls;
+    long long upload_bytes;
+    // Wall edges of the maze and the runs they were merged into, set by the game loop
+    int wall_edges;
+    int wall_runs;
+
+    GLTtext *text;
+
+    PerfOverlay(){
+        visible = false;
+        key_down = false;
+        frame = 0;
+        pass = -1;
+        for(int i = 0; i<OVERLAY_LATENCY; i++)
+            for(int j = 0; j<NUM_PASSES; j++){
+                queries[i][j] = 0;
+                issued[i][j] = false;
+            }
+        for(int i = 0; i<OVERLAY_FRAMES; i++)
+            frame_ms[i] = 0;
+        for(int i = 0; i<NUM_PASSES; i++)
+            gpu_ms[i] = 0;
+        frame_start = -1;
+        draw_calls = 0;
+        upload_bytes = 0;
+        wall_edges = 0;
+        wall_runs = 0;
+        text = NULL;
+    }
+
+    // Needs a current context and gltInit
+    int init();
+    void release();
+
+    void poll(GLFWwindow*);
+    void begin_frame();
+    void begin_pass(int);
+    void end_pass();
+    // Gathers the frame's numbers and draws the overlay when it is on
+    int end_frame(int);
+};
+
+int PerfOverlay::init(){
+    glGenQueries(OVERLAY_LATENCY*NUM_PASSES, &queries[0][0]);
+    text = gltCreateText();
+    return text == NULL ? EXT_FAIL : EXT_SUCC;
+}
+
+void PerfOverlay::release(){
+    if(text == NULL)
+        return;
+    glDeleteQueries(OVERLAY_LATENCY*NUM_PASSES, &queries[0][0]);
+    gltDeleteText(text);
+    text = NULL;
+}
+
+void PerfOverlay::poll(GLFWwindow *window){
+    bool down = glfwGetKey(window, GLFW_KEY_F3) == GLFW_PRESS;
+    if(down && !key_down){
+        visible = !visible;
+        // The zones are only recorded while someone reads them
+        if(visible)
+            profiler.enable();
+        else
+            profiler.disable();
+    }
+    key_down = down;
+}
+
+void PerfOverlay::begin_frame(){
+    double now = glfwGetTime();
+    if(frame_start >= 0)
+        frame_ms[frame % OVERLAY_FRAMES] = (now - frame_start)*1000.0;
+    frame_start = now;
+
+    frame++;
+
+    if(!visible || text == NULL)
+        return;
+
+    // The oldest set is reused this frame, whatever finished is read first
+    int slot = frame % OVERLAY_LATENCY;
+    for(int i = 0; i<NUM_PASSES; i++){
+        if(!issued[slot][i])
+            continue;
+        issued[slot][i] = false;
+
+        int available = 0;
+        glGetQueryObjectiv(queries[slot][i], GL_QUERY_RESULT_AVAILABLE, &available);
+        if(!available)
+            continue;
+
+        unsigned int ns = 0;
+        glGetQueryObjectuiv(queries[slot][i], GL_QUERY_RESULT, &ns);
+        gpu_ms[i] = ns/1e6;
+    }
+}
+
+void PerfOverlay::begin_pass(int index){
+    if(!visible || text == NULL || pass != -1)
+        return;
+    pass = index;
+    glBeginQuery(GL_TIME_ELAPSED, queries[frame % OVERLAY_LATENCY][index]);
+}
+
+void PerfOverlay::end_pass(){
+    if(pass == -1)
+        return;
+    glEndQuery(GL_TIME_ELAPSED);
+    issued[frame % OVERLAY_LATENCY][pass] = true;
+    pass = -1;
+}
+
+int PerfOverlay::end_frame(int wall_draws){
+    draw_calls = wall_draws + frame_batch.draw_calls + crewmates.draw_calls;
+    upload_bytes = frame_upload_bytes;
+
+    if(!visible || text == NULL)
+        return EXT_SUCC;
+
+    // Frame time graph in the top right corner, one bar per frame and a line at 60 fps
+    float left = 0.45f, right = 0.95f, bottom = 0.6f, top = 0.95f;
+    float scale = (top - bottom)/50.0f;
+    std::vector<GLfloat> vertices;
+    std::vector<unsigned int> indices;
+
+    for(int i = 0; i<OVERLAY_FRAMES; i++){
+        // Oldest first, the next slot begin_frame writes to holds the oldest frame
+        float ms = frame_ms[(frame + i) % OVERLAY_FRAMES];
+        float x = left + (right - left)*i/OVERLAY_FRAMES;
+        float y = bottom + min(ms, 50.0f)*scale;
+        float r = ms > 1000.0f/60 ? 1.0f : 0.2f;
+        float g = ms > 1000.0f/30 ? 0.2f : 1.0f;
+        vertices.insert(vertices.end(), {x, bottom, 0.0f, r, g, 0.2f, x, y, 0.0f, r, g, 0.2f});
+        indices.insert(indices.end(), {(unsigned int)(2*i), (unsigned int)(2*i+1)});
+    }
+
+    unsigned int base = vertices.size()/6;
+    float target = bottom + 1000.0f/60*scale;
+    vertices.insert(vertices.end(), {left, target, 0.0f, 1.0f, 1.0f, 1.0f, right, target, 0.0f, 1.0f, 1.0f, 1.0f});
+    indices.insert(indices.end(), {base, base+1});
+
+    // The view only moves by the camera, so this keeps the graph in place on screen
+    frame_batch.add(GL_LINES, vertices, indices, cameraPos - glm::vec3(0.0f, 0.0f, 1.0f));
+    frame_batch.flush(shaderProgram);
+
+    double worst = 0, total = 0;
+    for(int i = 0; i<OVERLAY_FRAMES; i++){
+        worst = max(worst, (double)frame_ms[i]);
+        total += frame_ms[i];
+    }
+
+    char line[128];
+    std::string str;
+    sprintf(line, "Frame %.2f ms  avg %.2f  max %.2f\n", frame_ms[(frame + OVERLAY_FRAMES - 1) % OVERLAY_FRAMES], total/OVERLAY_FRAMES, worst);
+    str += line;
+
+    // Slowest zones first
+    std::vector<std::pair<long long, const char*>> zones;
+    for(int i = 0; i<profiler.frame_zones.size(); i++)
+        zones.push_back(std::make_pair(profiler.frame_zones[i].ss, profiler.frame_zones[i].ff));
+    std::sort(zones.rbegin(), zones.rend());
+    for(int i = 0; i<zones.size(); i++){
+        sprintf(line, "CPU %-22s %7.3f ms\n", zones[i].ss, zones[i].ff/1e6);
+        str += line;
+    }
+
+    for(int i = 0; i<NUM_PASSES; i++){
+        sprintf(line, "GPU %-22s %7.3f ms\n", pass_names[i], gpu_ms[i]);
+        str += line;
+    }
+
+    sprintf(line, "Draw calls %d  uploaded %.1f KB\n", draw_calls, upload_bytes/1024.0);
+    str += line;
+    sprintf(line, "Wall edges %d merged into %d runs\n", wall_edges, wall_runs);
+    str += line;
+
+    if(input_latency.count > 0){
+        sprintf(line, "Input to swap %.2f ms  p99 %.2f\n", input_latency.percentile(0.5), input_latency.percentile(0.99));
+        str += line;
+    }
+
+    sprintf(line, "Heap %lld allocations %.1f KB  live %.2f MB\n", accounting.allocations, accounting.bytes/1024.0, heap_live_bytes.load()/1048576.0);
+    str += line;
+    int sites = min(num_zone_sites.load(), PROFILE_SITES);
+    for(int i = 0; i<sites; i++){
+        ZoneSite *site = zone_sites[i];
+        if(site == NULL || accounting.site_allocations[i] == 0)
+            continue;
+        sprintf(line, "    %-22s %5lld allocations\n", site->name, accounting.site_allocations[i]);
+        str += line;
+    }
+
+    str += "GL";
+    for(int i = 0; i<NUM_GL_RESOURCES; i++){
+        sprintf(line, " %s %lld", gl_resource_names[i], gl_live[i]);
+        str += line;
+    }
+
+    gltSetText(text, str.c_str());
+    gltBeginDraw();
+    gltColor(1.0f, 1.0f, 1.0f, 1.0f);
+    gltDrawText2D(text, SCR_WIDTH*(1 + left)/2, SCR_HEIGHT*(1 - bottom)/2 + 10.0f, 1.5f);
+    gltEndDraw();
+
+    return EXT_SUCC;
+}
+
+#endif
@@ -1,5 +1,7 @@
 #include "defs.hpp"
 #include "world.hpp"
+#include "crewmate.hpp"
+#include "input.hpp"
 
 #ifndef PLAYER_H
 #define PLAYER_H
@@ -7,8 +9,8 @@
 
 class Player{
 public:
+    // Corners of the crewmate around its spawn point, all the collision checks look at
     std::vector<GLfloat> vertices;
-    std::vector<unsigned int> indices;
 
     bool dead;
     int score;
@@ -16,11 +18,22 @@ public:
 
     glm::vec3 position;
 
+    // Spawn point, position is counted from here
+    glm::vec3 origin;
+    glm::vec3 body;
+    glm::vec3 visor;
+    // Visibility, 0 hides the crewmate and 1 shows it at full color
+    float tint;
+
     Player(){
         dead = false;
         score = 0;
         time = TIME_LIMIT;
         position = glm::vec3(0.0f, 0.0f, 0.0f);
+        origin = glm::vec3(0.0f, 0.0f, 0.0f);
+        body = glm::vec3(0.4196f, 0.7568f, 0.1373f);
+        visor = glm::vec3(0.9000f, 0.9100f, 0.9800f);
+        tint = 1.0f;
     }
 
     int init(float, float);
@@ -33,92 +46,40 @@ public:
 };
 
 int Player::init(float pos_x, float pos_y){
-    float width = ((float)CELL_WIDTH/SCR_WIDTH) * 0.3;
-    float height = ((float)CELL_WIDTH/SCR_HEIGHT) * 0.3;
-
-    // rectangle
-    for(int i = -1; i<=1; i+=2){
-        for(int j = -1; j<=1; j+=2){
-            vertices.insert(vertices.end(), {(pos_x+j*width/2), (pos_y+i*height/2), 0});
-            vertices.insert(vertices.end(), {0.4196f, 0.7568f, 0.1373f});
-        }
+    origin = glm::vec3(pos_x, pos_y, 0.0f);
+
+    // The mesh itself is shared, only its extent is kept
+    std::vector<GLfloat> mesh;
+    std::vector<unsigned short> mesh_indices;
+    crewmate_mesh(mesh, mesh_indices);
+
+    float x_low = INF, x_high = -INF, y_low = INF, y_high = -INF;
+    for(int i = 0; i<mesh.size(); i+=3){
+        x_low = min(x_low, mesh[i]);
+        x_high = max(x_high, mesh[i]);
+        y_low = min(y_low, mesh[i+1]);
+        y_high = max(y_high, mesh[i+1]);
     }
 
-    for(unsigned int i = 0; i<=1; i++){
-        indices.insert(indices.end(), {i, i+1, i+2});
-    }
-
-    // visor
-    for(int i = -1; i<=1; i+=2){
-        for(int j = -1; j<=1; j+=2){
-            vertices.insert(vertices.end(), {(pos_x+j*width/3), (height/2+pos_y+i*height/4), 0});
-            vertices.insert(vertices.end(), {0.9000f, 0.9100f, 0.9800f});
+    vertices.clear();
+    for(int i = 0; i<=1; i++){
+        for(int j = 0; j<=1; j++){
+            vertices.insert(vertices.end(), {pos_x + (j ? x_high : x_low), pos_y + (i ? y_high : y_low), 0});
+            vertices.insert(vertices.end(), {body.x, body.y, body.z});
         }
     }
 
-    for(unsigned int i = 0; i<=1; i++){
-        indices.insert(indices.end(), {4+i, 5+i, 6+i});
-    }
-
-    //semi-circle
-    vertices.insert(vertices.end(), {pos_x+0.0f, pos_y+height/2, 0.0f});
-    vertices.insert(vertices.end(), {0.4196f, 0.7568f, 0.1373f});
-
-    float cur_angle = 0;
-    float increment = 5.0;
-    
-    for(int i = 0; i<= 180.0/increment; i++){
-        vertices.insert(vertices.end(), {(pos_x+(width/2)*(float)cos(cur_angle)), (pos_y+(height/2)*(1+(float)sin(cur_angle))), 0});
-        vertices.insert(vertices.end(), {0.4196f, 0.7568f, 0.1373f});
-        cur_angle += glm::radians(increment);
-    }
-
-    for(unsigned int i = 0; i<180.0/increment; i++){
-        indices.insert(indices.end(), {8, (i+9), (i+10)});
-    }
-
-    time += (int)glfwGetTime();
+    time += (int)game_clock();
 
     return EXT_SUCC;
 }
 
-int Player::draw(unsigned int shaderProgram, GLFWwindow *window){
-    unsigned int VBO, VAO, EBO;
-
-    glUseProgram(shaderProgram);
-
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
-    glGenBuffers(1, &EBO);
-    // first parameter is for number of buffer objects to create
-    // bind the Vertex Array Object first, then bind and set vertex buffer(s), and then configure vertex attributes(s).
-    glBindVertexArray(VAO);
-
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size()*sizeof(GLfloat), &vertices[0], GL_DYNAMIC_DRAW);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size()*sizeof(unsigned int), &indices[0], GL_DYNAMIC_DRAW);
+int Player::draw(unsigned int, GLFWwindow*){
+    if(dead)
+        return EXT_FAIL;
 
-    // position attribute
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-    // color attribute
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
-
-    // make the camera look in the 'front' direction
-    glm::mat4 view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
-    unsigned int viewLoc = glGetUniformLocation(shaderProgram, "view");
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-
-    glm::mat4 model = glm::mat4(1.0f);
-    model = glm::translate(model, position);
-    
-    unsigned int modelLoc = glGetUniformLocation(shaderProgram, "model");
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
-    glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+    crewmates.add(origin + position, tint, body, visor);
+    return EXT_SUCC;
 }
 
 int Player::move(int dir, float speed, Maze &maze){
@@ -176,7 +137,6 @@ void Player::kill(){
     for(int i = 0; i<vertices.size(); i++){
         vertices[i] = 0;
     }
-    indices.clear();
 }
 
 
@@ -0,0 +1,306 @@
+#include "defs.hpp"
+#include "counters.hpp"
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <atomic>
+#include <chrono>
+
+
+/*
+    Scoped CPU profiling zones, exported as a Chrome trace (chrome://tracing or Perfetto)
+    Every thread writes its zones to its own fixed size ring of events, so recording takes no lock,
+    only the thread's first zone registers its ring with a single atomic increment
+    Nothing is recorded until the profiler is enabled, and with PROFILER set to 0 the zones compile to nothing
+    Each zone in the code also has a site that the heap allocations made inside it are counted against,
+    and with the hardware counters on, the cycles, instructions and misses spent inside it
+*/
+
+// Zones kept per thread, older ones are overwritten once a thread records more
+#define PROFILE_EVENTS (1<<16)
+// Threads that can record zones
+#define PROFILE_THREADS     64
+// Zones in the code that can count allocations
+#define PROFILE_SITES       64
+
+class ProfileEvent{
+public:
+    const char *name;
+    long long start_ns;
+    long long end_ns;
+};
+
+class ThreadTrace{
+public:
+    int tid;
+    ProfileEvent events[PROFILE_EVENTS];
+    // Only written by the owning thread, published after the event it counts
+    std::atomic<long long> count;
+    // Events already summed by end_frame, only touched by the thread that calls it
+    long long collected;
+
+    ThreadTrace(int t){
+        tid = t;
+        count = 0;
+        collected = 0;
+    }
+};
+
+class Profiler{
+public:
+    std::atomic<bool> enabled;
+    // Everything that reads the zones, the trace, the overlay or the flight recorder
+    int users;
+    std::atomic<int> num_threads;
+    // Set by each thread as it registers, read while others may still be registering
+    std::atomic<ThreadTrace*> threads[PROFILE_THREADS];
+
+    // Zones are measured from here
+    std::chrono::steady_clock::time_point epoch;
+
+    Profiler(){
+        enabled = false;
+        users = 0;
+        num_threads = 0;
+        for(int i = 0; i<PROFILE_THREADS; i++)
+            threads[i] = NULL;
+        epoch = std::chrono::steady_clock::now();
+    }
+
+    ~Profiler(){
+        for(int i = 0; i<PROFILE_THREADS; i++)
+            delete threads[i].load();
+    }
+
+    long long now(){
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    // Time per zone name over the last frame, names are kept once the frame is over so it never allocates
+    std::vector<std::pair<const char*, long long>> frame_zones;
+
+    // Recording goes on with the first user and off with the last one, the first caller is shown as the main thread
+    void enable();
+    void disable();
+    // Ring of the calling thread, NULL once every slot is taken
+    ThreadTrace *local();
+    void record(const char*, long long, long long);
+    // Sums up the zones recorded on every thread since the last call into frame_zones
+    void end_frame();
+    // Writes every recorded zone as Chrome trace JSON
+    int write(const char*);
+};
+
+void Profiler::enable(){
+    local();
+    users++;
+    enabled = true;
+}
+
+void Profiler::disable(){
+    users--;
+    enabled = users > 0;
+}
+
+ThreadTrace *Profiler::local(){
+    static thread_local ThreadTrace *trace = NULL;
+    static thread_local bool registered = false;
+    if(registered)
+        return trace;
+
+    registered = true;
+    int slot = num_threads.fetch_add(1);
+    if(slot >= PROFILE_THREADS)
+        return NULL;
+
+    trace = new ThreadTrace(slot);
+    threads[slot] = trace;
+    return trace;
+}
+
+void Profiler::record(const char *name, long long start_ns, long long end_ns){
+    ThreadTrace *trace = local();
+    if(trace == NULL)
+        return;
+
+    long long index = trace->count.load(std::memory_order_relaxed);
+    ProfileEvent &event = trace->events[index % PROFILE_EVENTS];
+    event.name = name;
+    event.start_ns = start_ns;
+    event.end_ns = end_ns;
+    trace->count.store(index+1, std::memory_order_release);
+}
+
+void Profiler::end_frame(){
+    for(int i = 0; i<frame_zones.size(); i++)
+        frame_zones[i].ss = 0;
+
+    int used = min(num_threads.load(), PROFILE_THREADS);
+    for(int i = 0; i<used; i++){
+        ThreadTrace *trace = threads[i];
+        if(trace == NULL)
+            continue;
+
+        // Zones that were already overwritten are skipped
+        long long count = trace->count.load(std::memory_order_acquire);
+        long long begin = max(trace->collected, count - PROFILE_EVENTS);
+        for(long long j = begin; j<count; j++){
+            ProfileEvent &event = trace->events[j % PROFILE_EVENTS];
+            int k = 0;
+            while(k < frame_zones.size() && strcmp(frame_zones[k].ff, event.name) != 0)
+                k++;
+            if(k == frame_zones.size())
+                frame_zones.push_back(std::make_pair(event.name, 0LL));
+            frame_zones[k].ss += event.end_ns - event.start_ns;
+        }
+        trace->collected = count;
+    }
+}
+
+int Profiler::write(const char *path){
+    FILE *out = fopen(path, "w");
+    if(out == NULL)
+        return EXT_FAIL;
+
+    fprintf(out, "{\"traceEvents\":[\n");
+    bool first = true;
+    long long dropped = 0;
+
+    int used = min(num_threads.load(), PROFILE_THREADS);
+    for(int i = 0; i<used; i++){
+        ThreadTrace *trace = threads[i];
+        if(trace == NULL)
+            continue;
+
+        fprintf(out, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"%s %d\"}}",
+                first ? "" : ",\n", trace->tid, trace->tid == 0 ? "main" : "thread", trace->tid);
+        first = false;
+
+        // Only the newest PROFILE_EVENTS zones are still in the ring
+        long long count = trace->count.load(std::memory_order_acquire);
+        long long begin = max(0LL, count - PROFILE_EVENTS);
+        dropped += begin;
+
+        for(long long j = begin; j<count; j++){
+            ProfileEvent &event = trace->events[j % PROFILE_EVENTS];
+            fprintf(out, ",\n{\"ph\":\"X\",\"name\":\"%s\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                    event.name, trace->tid, event.start_ns/1e3, (event.end_ns - event.start_ns)/1e3);
+        }
+    }
+
+    fprintf(out, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    fclose(out);
+
+    if(dropped > 0)
+        printf("Trace: %lld oldest zones were overwritten\n", dropped);
+
+    return EXT_SUCC;
+}
+
+// Shared by every thread
+Profiler profiler;
+
+// One per PROFILE_ZONE in the code, made the first time it runs
+class ZoneSite{
+public:
+    const char *name;
+    // Heap allocations made while the zone is the innermost one on its thread
+    std::atomic<long long> allocations;
+    std::atomic<long long> bytes;
+
+    // Zones that read the hardware counters and the events they saw, nested zones are included
+    std::atomic<long long> counted;
+    std::atomic<long long> events[NUM_HW_COUNTERS];
+
+    ZoneSite(const char*);
+};
+
+std::atomic<ZoneSite*> zone_sites[PROFILE_SITES];
+std::atomic<int> num_zone_sites(0);
+// Innermost zone of each thread, NULL outside of every zone
+thread_local ZoneSite *current_site = NULL;
+
+ZoneSite::ZoneSite(const char *n){
+    name = n;
+    allocations = 0;
+    bytes = 0;
+    counted = 0;
+    for(int i = 0; i<NUM_HW_COUNTERS; i++)
+        events[i] = 0;
+
+    // Sites past the table still time their zone, their allocations go uncounted per site
+    int slot = num_zone_sites.fetch_add(1);
+    if(slot < PROFILE_SITES)
+        zone_sites[slot] = this;
+}
+
+// Records the time from its construction to the end of the enclosing scope
+class ProfileZone{
+public:
+    ZoneSite *site;
+    ZoneSite *outer;
+    long long start_ns;
+    bool counting;
+    long long start_events[NUM_HW_COUNTERS];
+
+    ProfileZone(ZoneSite *s){
+        site = s;
+        outer = current_site;
+        current_site = site;
+
+        // Read outside of the timing so the zone's time does not include its own counter reads
+        counting = hw_counters.enabled.load(std::memory_order_relaxed) && hw_counters.read(start_events) == EXT_SUCC;
+
+        start_ns = -1;
+        if(profiler.enabled.load(std::memory_order_relaxed))
+            start_ns = profiler.now();
+    }
+
+    ~ProfileZone(){
+        if(start_ns >= 0)
+            profiler.record(site->name, start_ns, profiler.now());
+
+        long long end_events[NUM_HW_COUNTERS];
+        if(counting && hw_counters.read(end_events) == EXT_SUCC){
+            for(int i = 0; i<NUM_HW_COUNTERS; i++)
+                site->events[i].fetch_add(end_events[i] - start_events[i], std::memory_order_relaxed);
+            site->counted.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        current_site = outer;
+    }
+};
+
+// Per zone hardware counter table for the whole run, averaged per call
+void report_counters(){
+    printf("%-24s %10s %12s %12s %6s %12s %12s\n", "zone", "calls", "cycles", "instructions", "IPC", "cache miss", "branch miss");
+
+    int sites = min(num_zone_sites.load(), PROFILE_SITES);
+    for(int i = 0; i<sites; i++){
+        ZoneSite *site = zone_sites[i];
+        if(site == NULL || site->counted == 0)
+            continue;
+
+        double calls = site->counted;
+        double per_call[NUM_HW_COUNTERS];
+        for(int j = 0; j<NUM_HW_COUNTERS; j++)
+            per_call[j] = site->events[j]/calls;
+
+        printf("%-24s %10lld %12.0f %12.0f %6.2f %12.1f %12.1f\n", site->name, site->counted.load(),
+               per_call[HW_CYCLES], per_call[HW_INSTRUCTIONS], per_call[HW_INSTRUCTIONS]/max(1.0, per_call[HW_CYCLES]),
+               per_call[HW_CACHE_MISSES], per_call[HW_BRANCH_MISSES]);
+    }
+}
+
+#if PROFILER
+#define PROFILE_CONCAT(a, b)    a##b
+#define PROFILE_NAME(a, b)      PROFILE_CONCAT(a, b)
+#define PROFILE_ZONE(name) \
+    static ZoneSite PROFILE_NAME(profile_site_, __LINE__)(name); \
+    ProfileZone PROFILE_NAME(profile_zone_, __LINE__)(&PROFILE_NAME(profile_site_, __LINE__))
+#else
+#define PROFILE_ZONE(name)
+#endif
+
+#endif
@@ -0,0 +1,222 @@
+#include "defs.hpp"
+#include "world.hpp"
+#include "player.hpp"
+#include "profile.hpp"
+#include "memory.hpp"
+#include "input.hpp"
+
+#ifndef RECORDER_H
+#define RECORDER_H
+
+
+/*
+    Flight recorder for frame hitches
+    Always keeps the last RECORDER_FRAMES frames: their time, zone times, heap allocations, bytes uploaded and
+    the cells of the player and the impostor. A frame slower than the threshold writes all of them to disk
+    RECORDER_FRAMES/2 frames later, so the file holds the frames on both sides of the hitch
+    The dump names what the run needs to be played again: the seed, the maze file, the endless window and
+    the input log written with --record-input
+    Recording a frame does not allocate, so the recorder does not show up in its own allocation counts
+*/
+
+#define RECORDER_FRAMES    240
+// Zones kept per frame
+#define RECORDER_ZONES      32
+
+class RecordedFrame{
+public:
+    long long frame;
+    float ms;
+    long long allocations;
+    long long upload_bytes;
+    // Seed of the round being played
+    unsigned int seed;
+    // Row and column of each, and the first row and column of the endless window they are counted from
+    int player[2];
+    int bot[2];
+    long long window[2];
+
+    int num_zones;
+    const char *zone_names[RECORDER_ZONES];
+    long long zone_ns[RECORDER_ZONES];
+};
+
+class FlightRecorder{
+public:
+    bool enabled;
+    // Frames slower than this are dumped
+    double threshold_ms;
+
+    RecordedFrame frames[RECORDER_FRAMES];
+    long long count;
+    double last_time;
+    long long last_allocations;
+
+    // Frame of the last dump, the next one waits until the ring holds only newer frames
+    long long last_dump;
+    int dumps;
+    // Hitch waiting for the frames after it, -1 when there is none, and the frames still to record
+    long long pending;
+    int countdown;
+
+    // How the run was started, written with every dump
+    const char *maze_path;
+    bool endless;
+
+    FlightRecorder(){
+        enabled = false;
+        threshold_ms = 0;
+        count = 0;
+        last_time = -1;
+        last_allocations = 0;
+        last_dump = -RECORDER_FRAMES;
+        dumps = 0;
+        pending = -1;
+        countdown = 0;
+        maze_path = NULL;
+        endless = false;
+    }
+
+    void enable(double);
+    // Called once per frame after profiler.end_frame, with the origin of the endless window
+    int record(Maze&, Player&, Player&, long long, long long);
+    // Writes a hitch still waiting for its later frames, for when the game stops first
+    int flush(Maze&);
+    int dump(const char*, Maze&);
+};
+
+void FlightRecorder::enable(double ms){
+    enabled = true;
+    threshold_ms = ms;
+    profiler.enable();
+}
+
+int FlightRecorder::record(Maze &world, Player &player, Player &bot, long long r0, long long c0){
+    if(!enabled)
+        return EXT_SUCC;
+
+    double now = glfwGetTime();
+    long long allocations = heap_allocations.load(std::memory_order_relaxed);
+
+    // The first call only sets the clocks
+    if(last_time < 0){
+        last_time = now;
+        last_allocations = allocations;
+        return EXT_SUCC;
+    }
+
+    RecordedFrame &cur = frames[count % RECORDER_FRAMES];
+    cur.frame = count;
+    cur.ms = (now - last_time)*1000.0;
+    cur.allocations = allocations - last_allocations;
+    cur.upload_bytes = frame_upload_bytes;
+    cur.seed = world.seed;
+    cur.window[0] = r0;
+    cur.window[1] = c0;
+
+    std::pair<std::pair<int, int>, std::pair<int, int>> bounds = world.get_bounds(player.vertices, player.position);
+    cur.player[0] = bounds.ss.ff;
+    cur.player[1] = bounds.ff.ff;
+    bounds = world.get_bounds(bot.vertices, bot.position);
+    cur.bot[0] = bounds.ss.ff;
+    cur.bot[1] = bounds.ff.ff;
+
+    // Zones that did not run this frame are left out
+    cur.num_zones = 0;
+    for(int i = 0; i<profiler.frame_zones.size() && cur.num_zones < RECORDER_ZONES; i++){
+        if(profiler.frame_zones[i].ss == 0)
+            continue;
+        cur.zone_names[cur.num_zones] = profiler.frame_zones[i].ff;
+        cur.zone_ns[cur.num_zones] = profiler.frame_zones[i].ss;
+        cur.num_zones++;
+    }
+
+    count++;
+    last_time = now;
+    last_allocations = allocations;
+
+    if(pending < 0 && cur.ms > threshold_ms && cur.frame - last_dump >= RECORDER_FRAMES){
+        pending = cur.frame;
+        countdown = RECORDER_FRAMES/2;
+        return EXT_SUCC;
+    }
+
+    if(pending < 0 || --countdown > 0)
+        return EXT_SUCC;
+
+    int ret = flush(world);
+    // Writing the file is not part of the next frame
+    last_time = glfwGetTime();
+    return ret;
+}
+
+int FlightRecorder::flush(Maze &world){
+    if(pending < 0)
+        return EXT_SUCC;
+
+    RecordedFrame &hitch = frames[pending % RECORDER_FRAMES];
+    last_dump = pending;
+    pending = -1;
+
+    char path[64];
+    sprintf(path, "hitch_%lld.json", hitch.frame);
+    if(dump(path, world) == EXT_FAIL)
+        return EXT_FAIL;
+
+    dumps++;
+    printf("Hitch: frame %lld took %.2f ms, wrote %s\n", hitch.frame, hitch.ms, path);
+    return EXT_SUCC;
+}
+
+// String or null, with the characters JSON does not allow as they are escaped
+void json_path(FILE *out, const char *path){
+    if(path == NULL){
+        fprintf(out, "null");
+        return;
+    }
+    fputc('"', out);
+    for(const char *c = path; *c != '\0'; c++){
+        if(*c == '"' || *c == '\\')
+            fputc('\\', out);
+        fputc(*c, out);
+    }
+    fputc('"', out);
+}
+
+int FlightRecorder::dump(const char *path, Maze &world){
+    FILE *out = fopen(path, "w");
+    if(out == NULL)
+        return EXT_FAIL;
+
+    // The round may have changed since the hitch, its own seed is the one to play again
+    RecordedFrame &hitch = frames[last_dump % RECORDER_FRAMES];
+    fprintf(out, "{\"hitch_frame\":%lld,\"seed\":%u,\"engine\":%d,\"rows\":%d,\"columns\":%d,\"threshold_ms\":%.3f,",
+            hitch.frame, hitch.seed, world.engine, world.rows, world.columns, threshold_ms);
+
+    // Flushed so the log holds every input up to the last recorded frame
+    if(input_events.record_file != NULL)
+        fflush(input_events.record_file);
+    fprintf(out, "\"maze\":");
+    json_path(out, maze_path);
+    fprintf(out, ",\"endless\":%s,\"window\":[%lld,%lld],\"input\":", endless ? "true" : "false", hitch.window[0], hitch.window[1]);
+    json_path(out, input_events.record_path);
+    fprintf(out, ",\"frames\":[\n");
+
+    // Oldest frame first
+    long long first = max(0LL, count - RECORDER_FRAMES);
+    for(long long i = first; i<count; i++){
+        RecordedFrame &cur = frames[i % RECORDER_FRAMES];
+        fprintf(out, "%s{\"frame\":%lld,\"ms\":%.3f,\"allocations\":%lld,\"upload_bytes\":%lld,\"player\":[%d,%d],\"bot\":[%d,%d],\"window\":[%lld,%lld],\"zones_us\":{",
+                i == first ? "" : ",\n", cur.frame, cur.ms, cur.allocations, cur.upload_bytes,
+                cur.player[0], cur.player[1], cur.bot[0], cur.bot[1], cur.window[0], cur.window[1]);
+        for(int j = 0; j<cur.num_zones; j++)
+            fprintf(out, "%s\"%s\":%.3f", j == 0 ? "" : ",", cur.zone_names[j], cur.zone_ns[j]/1e3);
+        fprintf(out, "}}");
+    }
+
+    fprintf(out, "\n]}\n");
+    fclose(out);
+    return EXT_SUCC;
+}
+
+#endif
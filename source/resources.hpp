@@ -0,0 +1,142 @@
+#include <glad/glad.h>
+
+#ifndef RESOURCES_H
+#define RESOURCES_H
+
+
+/*
+    Accounting of GL objects and uploads
+    The glad names of the calls that create, delete or fill GL objects are redefined to go through a counter first,
+    so every object made by the game or by glText is counted without touching the calls themselves
+    Included by defs.hpp right after glad, before anything that makes GL calls
+*/
+
+#define GL_RES_BUFFER           0
+#define GL_RES_VERTEX_ARRAY     1
+#define GL_RES_TEXTURE          2
+#define GL_RES_QUERY            3
+#define GL_RES_SHADER           4
+#define GL_RES_PROGRAM          5
+#define GL_RES_SYNC             6
+#define NUM_GL_RESOURCES        7
+
+#define GL_UPLOAD_BUFFER        0
+#define GL_UPLOAD_TEXTURE       1
+
+const char *gl_resource_names[NUM_GL_RESOURCES] = {"buffers", "vertex arrays", "textures", "queries", "shaders", "programs", "syncs"};
+
+// Objects alive right now per type, GL is only used from one thread
+long long gl_live[NUM_GL_RESOURCES];
+// Bytes sent since the start, to buffers and to textures
+long long gl_uploaded[2];
+// Bytes sent to GL buffers and textures since the frame started
+long long frame_upload_bytes = 0;
+
+void gl_account_gen(int type, GLsizei n, GLuint *ids, PFNGLGENBUFFERSPROC gen){
+    gen(n, ids);
+    gl_live[type] += n;
+}
+
+void gl_account_delete(int type, GLsizei n, const GLuint *ids, PFNGLDELETEBUFFERSPROC del){
+    // GL skips 0 as well
+    for(int i = 0; i<n; i++)
+        if(ids[i] != 0)
+            gl_live[type]--;
+    del(n, ids);
+}
+
+GLuint gl_account_created(int type, GLuint id){
+    if(id != 0)
+        gl_live[type]++;
+    return id;
+}
+
+GLuint gl_account_deleted(int type, GLuint id){
+    if(id != 0)
+        gl_live[type]--;
+    return id;
+}
+
+GLsync gl_account_sync(GLsync sync, int change){
+    if(sync != NULL)
+        gl_live[GL_RES_SYNC] += change;
+    return sync;
+}
+
+// Data written without a GL call, such as into a mapped buffer
+void gl_account_write(int kind, long long bytes){
+    gl_uploaded[kind] += bytes;
+    frame_upload_bytes += bytes;
+}
+
+const void *gl_account_buffer(GLsizeiptr size, const void *data){
+    // Without data the storage is only allocated
+    if(data != NULL)
+        gl_account_write(GL_UPLOAD_BUFFER, size);
+    return data;
+}
+
+const void *gl_account_texture(GLsizei w, GLsizei h, GLenum format, GLenum type, const void *pixels){
+    if(pixels == NULL)
+        return pixels;
+
+    int components = 4;
+    if(format == GL_RED || format == GL_RED_INTEGER)
+        components = 1;
+    else if(format == GL_RG || format == GL_RG_INTEGER)
+        components = 2;
+    else if(format == GL_RGB || format == GL_RGB_INTEGER)
+        components = 3;
+
+    int size = 1;
+    if(type == GL_FLOAT || type == GL_INT || type == GL_UNSIGNED_INT)
+        size = 4;
+    else if(type == GL_SHORT || type == GL_UNSIGNED_SHORT || type == GL_HALF_FLOAT)
+        size = 2;
+
+    gl_account_write(GL_UPLOAD_TEXTURE, (long long)w*h*components*size);
+    return pixels;
+}
+
+#undef glGenBuffers
+#define glGenBuffers(n, ids)                gl_account_gen(GL_RES_BUFFER, n, ids, glad_glGenBuffers)
+#undef glDeleteBuffers
+#define glDeleteBuffers(n, ids)             gl_account_delete(GL_RES_BUFFER, n, ids, glad_glDeleteBuffers)
+#undef glGenVertexArrays
+#define glGenVertexArrays(n, ids)           gl_account_gen(GL_RES_VERTEX_ARRAY, n, ids, glad_glGenVertexArrays)
+#undef glDeleteVertexArrays
+#define glDeleteVertexArrays(n, ids)        gl_account_delete(GL_RES_VERTEX_ARRAY, n, ids, glad_glDeleteVertexArrays)
+#undef glGenTextures
+#define glGenTextures(n, ids)               gl_account_gen(GL_RES_TEXTURE, n, ids, glad_glGenTextures)
+#undef glDeleteTextures
+#define glDeleteTextures(n, ids)            gl_account_delete(GL_RES_TEXTURE, n, ids, glad_glDeleteTextures)
+#undef glGenQueries
+#define glGenQueries(n, ids)                gl_account_gen(GL_RES_QUERY, n, ids, glad_glGenQueries)
+#undef glDeleteQueries
+#define glDeleteQueries(n, ids)             gl_account_delete(GL_RES_QUERY, n, ids, glad_glDeleteQueries)
+
+#undef glCreateShader
+#define glCreateShader(type)                gl_account_created(GL_RES_SHADER, glad_glCreateShader(type))
+#undef glDeleteShader
+#define glDeleteShader(id)                  glad_glDeleteShader(gl_account_deleted(GL_RES_SHADER, id))
+#undef glCreateProgram
+#define glCreateProgram()                   gl_account_created(GL_RES_PROGRAM, glad_glCreateProgram())
+#undef glDeleteProgram
+#define glDeleteProgram(id)                 glad_glDeleteProgram(gl_account_deleted(GL_RES_PROGRAM, id))
+#undef glFenceSync
+#define glFenceSync(condition, flags)       gl_account_sync(glad_glFenceSync(condition, flags), 1)
+#undef glDeleteSync
+#define glDeleteSync(sync)                  glad_glDeleteSync(gl_account_sync(sync, -1))
+
+#undef glBufferData
+#define glBufferData(target, size, data, usage)    glad_glBufferData(target, size, gl_account_buffer(size, data), usage)
+#undef glBufferSubData
+#define glBufferSubData(target, offset, size, data)    glad_glBufferSubData(target, offset, size, gl_account_buffer(size, data))
+#undef glTexImage2D
+#define glTexImage2D(target, level, internal, w, h, border, format, type, pixels) \
+    glad_glTexImage2D(target, level, internal, w, h, border, format, type, gl_account_texture(w, h, format, type, pixels))
+#undef glTexSubImage2D
+#define glTexSubImage2D(target, level, x, y, w, h, format, type, pixels) \
+    glad_glTexSubImage2D(target, level, x, y, w, h, format, type, gl_account_texture(w, h, format, type, pixels))
+
+#endif
@@ -0,0 +1,181 @@
+#include "defs.hpp"
+
+#ifndef RING_H
+#define RING_H
+
+
+/*
+    Ring buffer for data that is rebuilt every frame
+    The buffer is split into one region per frame in flight, a frame only writes to its own region and a fence
+    tells when the GPU is done reading it, so nothing gets orphaned or copied by the driver
+    With ARB_buffer_storage the buffer stays mapped and the data is written straight into it,
+    without it every write goes through glBufferSubData
+*/
+
+#define RING_FRAMES          3
+#define RING_REGION    (1<<20)
+
+// Not in the GL 3.3 headers
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT   0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT     0x0080
+#endif
+
+typedef void (APIENTRYP buffer_storage_proc)(GLenum, GLsizeiptr, const void*, GLbitfield);
+
+class StreamBuffer{
+public:
+    unsigned int buffer;
+    // Same vertex layout as every other mesh, 3 floats of position and 3 of color
+    unsigned int vao;
+
+    bool persistent;
+    unsigned char *mapped;
+    GLsync fences[RING_FRAMES];
+
+    int frame;
+    // Bytes written to the current region
+    size_t used;
+    // Frames that had to wait for the GPU to let go of their region
+    long long stalls;
+
+    StreamBuffer(){
+        buffer = 0;
+        vao = 0;
+        persistent = false;
+        mapped = NULL;
+        for(int i = 0; i<RING_FRAMES; i++)
+            fences[i] = NULL;
+        frame = 0;
+        used = 0;
+        stalls = 0;
+    }
+
+    // Needs a current context
+    int init();
+    void release();
+
+    void begin_frame();
+    void end_frame();
+
+    // Copies the data to the current region, returns its offset in the buffer or -1 once the region is full
+    long long push(const void*, size_t, size_t);
+};
+
+int StreamBuffer::init(){
+    glGenVertexArrays(1, &vao);
+    glGenBuffers(1, &buffer);
+
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+
+    buffer_storage_proc buffer_storage = NULL;
+    if(glfwExtensionSupported("GL_ARB_buffer_storage"))
+        buffer_storage = (buffer_storage_proc)glfwGetProcAddress("glBufferStorage");
+
+    if(buffer_storage != NULL){
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        buffer_storage(GL_ARRAY_BUFFER, RING_FRAMES*RING_REGION, NULL, flags);
+        mapped = (unsigned char*)glMapBufferRange(GL_ARRAY_BUFFER, 0, RING_FRAMES*RING_REGION, flags);
+        persistent = (mapped != NULL);
+    }
+
+    // Storage made by glBufferStorage can not be changed, a failed map needs a new buffer
+    if(!persistent){
+        if(buffer_storage != NULL){
+            glDeleteBuffers(1, &buffer);
+            glGenBuffers(1, &buffer);
+            glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        }
+        glBufferData(GL_ARRAY_BUFFER, RING_FRAMES*RING_REGION, NULL, GL_STREAM_DRAW);
+    }
+
+    // position attribute
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    // color attribute
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+
+    // Indices come from the same buffer
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
+
+    glBindVertexArray(0);
+
+    return EXT_SUCC;
+}
+
+void StreamBuffer::release(){
+    if(buffer == 0)
+        return;
+
+    for(int i = 0; i<RING_FRAMES; i++){
+        if(fences[i] != NULL)
+            glDeleteSync(fences[i]);
+        fences[i] = NULL;
+    }
+
+    if(persistent){
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+    }
+
+    glDeleteVertexArrays(1, &vao);
+    glDeleteBuffers(1, &buffer);
+    buffer = 0;
+    vao = 0;
+    mapped = NULL;
+    persistent = false;
+}
+
+void StreamBuffer::begin_frame(){
+    frame = (frame+1) % RING_FRAMES;
+    used = 0;
+
+    if(fences[frame] == NULL)
+        return;
+
+    // Usually long signalled, RING_FRAMES-1 frames went by since it was placed
+    GLenum ret = glClientWaitSync(fences[frame], GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    if(ret == GL_TIMEOUT_EXPIRED){
+        stalls++;
+        while(ret == GL_TIMEOUT_EXPIRED)
+            ret = glClientWaitSync(fences[frame], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+    }
+
+    glDeleteSync(fences[frame]);
+    fences[frame] = NULL;
+}
+
+void StreamBuffer::end_frame(){
+    // glBufferSubData is already ordered against the draws by the driver
+    if(persistent)
+        fences[frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+long long StreamBuffer::push(const void *data, size_t bytes, size_t align){
+    // Aligned within the whole buffer, regions do not start on a multiple of every vertex size
+    size_t region = (size_t)frame*RING_REGION;
+    size_t offset = (region + used + align - 1)/align*align;
+    if(offset + bytes > region + RING_REGION)
+        return -1;
+
+    if(persistent){
+        memcpy(mapped + offset, data, bytes);
+        gl_account_write(GL_UPLOAD_BUFFER, bytes);
+    }
+    else{
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glBufferSubData(GL_ARRAY_BUFFER, offset, bytes, data);
+    }
+
+    used = offset + bytes - region;
+    return offset;
+}
+
+// Shared by everything that draws per frame data
+StreamBuffer frame_stream;
+
+#endif
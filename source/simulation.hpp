@@ -0,0 +1,393 @@
+#include "defs.hpp"
+#include "world.hpp"
+#include "player.hpp"
+#include "graphics_setup.hpp"
+#include "joint.hpp"
+#include "jobs.hpp"
+#include "level.hpp"
+
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <thread>
+#include <atomic>
+
+
+/*
+    Runs the simulation on its own thread so it overlaps with drawing and with the wait in glfwSwapBuffers
+    The thread that owns the window samples the keys every frame and sends them over a single producer single
+    consumer queue, the simulation runs one tick per input and publishes what the draw reads as a snapshot
+    through a triple buffer, so neither side ever waits on the other in a normal frame
+    A new round or a move of the endless window needs GL, the simulation then stops after publishing its
+    snapshot until the render thread made the change and handed the new state back
+*/
+
+// Inputs the render thread can be ahead of the simulation
+#define INPUT_QUEUE         64
+// Sleep of the simulation while it has no input or is parked
+#define SIM_IDLE_US        100
+
+// What the render thread has to do before the simulation goes on
+#define SIM_NONE             0
+#define SIM_NEXT_ROUND       1
+#define SIM_ENDLESS_ROUND    2
+#define SIM_SHIFT            3
+
+class InputQueue{
+public:
+    InputState items[INPUT_QUEUE];
+    // Written by one side each, head by the consumer and tail by the producer
+    std::atomic<long long> head;
+    std::atomic<long long> tail;
+
+    InputQueue(){
+        head = 0;
+        tail = 0;
+    }
+
+    // EXT_FAIL when full, or when empty for pop
+    int push(InputState&);
+    int pop(InputState&);
+};
+
+int InputQueue::push(InputState &input){
+    long long t = tail.load(std::memory_order_relaxed);
+    if(t - head.load(std::memory_order_acquire) == INPUT_QUEUE)
+        return EXT_FAIL;
+    items[t % INPUT_QUEUE] = input;
+    tail.store(t + 1, std::memory_order_release);
+    return EXT_SUCC;
+}
+
+int InputQueue::pop(InputState &input){
+    long long h = head.load(std::memory_order_relaxed);
+    if(tail.load(std::memory_order_acquire) == h)
+        return EXT_FAIL;
+    input = items[h % INPUT_QUEUE];
+    head.store(h + 1, std::memory_order_release);
+    return EXT_SUCC;
+}
+
+// Everything the render thread reads from the simulation for one frame
+class FrameSnapshot{
+public:
+    long long tick;
+    int request;
+    bool end_game;
+
+    Player player;
+    Player bot;
+    glm::vec3 camera;
+
+    bool lights;
+    int tasks;
+    bool powerup_activated;
+    std::vector<std::pair<std::pair<int, int>, int>> powerup_pos;
+
+    // Colors of the walls and the light distances, only copied when the lights changed them
+    int color_version;
+    std::vector<GLfloat> wall_vertices;
+    std::vector<unsigned char> light_dist;
+
+    std::vector<GLfloat> end_vertices;
+    std::vector<GLfloat> bot_kill_vertices;
+    std::vector<GLfloat> powerup_vertices;
+    std::vector<GLfloat> powerups_vertices;
+    std::vector<unsigned int> powerups_indices;
+
+    FrameSnapshot(){
+        tick = 0;
+        request = SIM_NONE;
+        end_game = false;
+        camera = glm::vec3(0.0f, 0.0f, 1.0f);
+        lights = true;
+        tasks = 0;
+        powerup_activated = false;
+        color_version = -1;
+    }
+
+    void capture(Maze&, Player&, Player&, glm::vec3);
+    // Copies the snapshot over the render thread's maze and crewmates and moves the camera
+    void apply(Maze&, Player&, Player&);
+};
+
+void FrameSnapshot::capture(Maze &world, Player &p, Player &b, glm::vec3 cam){
+    player = p;
+    bot = b;
+    camera = cam;
+
+    lights = world.lights;
+    tasks = world.tasks;
+    powerup_activated = world.powerup_activated;
+    powerup_pos = world.powerup_pos;
+
+    if(color_version != world.color_version){
+        color_version = world.color_version;
+        wall_vertices = world.wall_vertices;
+        light_dist = world.light_dist;
+    }
+
+    end_vertices = world.end_vertices;
+    bot_kill_vertices = world.bot_kill_vertices;
+    powerup_vertices = world.powerup_vertices;
+    powerups_vertices = world.powerups_vertices;
+    powerups_indices = world.powerups_indices;
+}
+
+void FrameSnapshot::apply(Maze &world, Player &p, Player &b){
+    p = player;
+    b = bot;
+    cameraPos = camera;
+
+    world.lights = lights;
+    world.tasks = tasks;
+    world.powerup_activated = powerup_activated;
+    world.powerup_pos = powerup_pos;
+
+    if(world.color_version != color_version){
+        world.color_version = color_version;
+        world.wall_vertices = wall_vertices;
+        world.light_dist = light_dist;
+    }
+
+    world.end_vertices = end_vertices;
+    world.bot_kill_vertices = bot_kill_vertices;
+    world.powerup_vertices = powerup_vertices;
+    world.powerups_vertices = powerups_vertices;
+    world.powerups_indices = powerups_indices;
+}
+
+/*
+    Triple buffer of snapshots, the simulation fills one slot while the render thread reads another
+    and the third holds the newest finished snapshot, a flag in the shared index tells whether it was read yet
+*/
+#define SNAPSHOT_FRESH       4
+
+class SnapshotBuffer{
+public:
+    FrameSnapshot slots[3];
+    // Slot owned by the simulation and slot owned by the render thread
+    int back;
+    int front;
+    std::atomic<int> middle;
+
+    SnapshotBuffer(){
+        back = 0;
+        front = 1;
+        middle = 2;
+    }
+
+    FrameSnapshot &write_slot(){
+        return slots[back];
+    }
+
+    FrameSnapshot &read_slot(){
+        return slots[front];
+    }
+
+    void publish();
+    // Takes the newest published snapshot, false when there was none since the last call
+    bool acquire();
+    // Makes the next captures copy the colors again, after the maze was replaced
+    void invalidate();
+};
+
+void SnapshotBuffer::publish(){
+    back = middle.exchange(back | SNAPSHOT_FRESH, std::memory_order_acq_rel) & 3;
+}
+
+bool SnapshotBuffer::acquire(){
+    if(!(middle.load(std::memory_order_acquire) & SNAPSHOT_FRESH))
+        return false;
+    front = middle.exchange(front, std::memory_order_acq_rel) & 3;
+    return true;
+}
+
+void SnapshotBuffer::invalidate(){
+    for(int i = 0; i<3; i++)
+        slots[i].color_version = -1;
+}
+
+class SimThread{
+public:
+    // The simulation's own copies, only touched by the render thread while it is parked
+    Maze world;
+    Player player;
+    Player bot;
+    glm::vec3 camera;
+    bool end_game;
+    bool endless_mode;
+    int prev_time;
+    long long ticks;
+
+    JobSystem *jobs;
+    InputQueue inputs;
+    SnapshotBuffer snapshots;
+
+    // Render thread only, inputs sent and the time of the ones that changed something, {input number, event time}
+    long long sent;
+    std::deque<std::pair<long long, long long>> unshown;
+
+    std::thread thread;
+    std::atomic<bool> quit;
+    // Set by the simulation before it publishes a request, cleared by the render thread once it is done
+    std::atomic<bool> parked;
+
+    SimThread() : world(MAZE_HEIGHT, MAZE_WIDTH, 0){
+        camera = glm::vec3(0.0f, 0.0f, 1.0f);
+        end_game = false;
+        endless_mode = false;
+        prev_time = 0;
+        ticks = 0;
+        jobs = NULL;
+        sent = 0;
+        quit = false;
+        parked = false;
+    }
+
+    ~SimThread(){
+        stop();
+    }
+
+    int start(Maze&, Player&, Player&, JobSystem&, bool);
+    void stop();
+
+    // Render thread, waits while the simulation is INPUT_QUEUE inputs behind, call after handling the last request
+    void send(InputState&);
+    // Render thread, applies the newest snapshot and returns its request, SIM_NONE when there was nothing new
+    int receive(Maze&, Player&, Player&, bool&);
+    // Render thread, hands the changed maze back and lets a parked simulation go on
+    void resume(Maze&, Player&, Player&);
+
+    void loop();
+    // One frame of the game's rules, returns the request for the render thread
+    int tick(InputState&);
+    void copy_from(Maze&, Player&, Player&);
+};
+
+void SimThread::copy_from(Maze &w, Player &p, Player &b){
+    world = w;
+    // The chunks hold GL buffers, only the render thread draws them
+    world.wall_chunks.clear();
+    player = p;
+    bot = b;
+    camera = cameraPos;
+    snapshots.invalidate();
+}
+
+int SimThread::start(Maze &w, Player &p, Player &b, JobSystem &j, bool endless){
+    copy_from(w, p, b);
+    jobs = &j;
+    endless_mode = endless;
+    prev_time = (int)game_clock();
+    thread = std::thread([this](){ loop(); });
+    return EXT_SUCC;
+}
+
+void SimThread::stop(){
+    quit = true;
+    if(thread.joinable())
+        thread.join();
+}
+
+void SimThread::send(InputState &input){
+    while(inputs.push(input) == EXT_FAIL && !quit)
+        std::this_thread::yield();
+    if(input.event_ns != 0)
+        unshown.push_back(std::make_pair(sent, input.event_ns));
+    sent++;
+}
+
+int SimThread::receive(Maze &w, Player &p, Player &b, bool &over){
+    if(!snapshots.acquire())
+        return SIM_NONE;
+
+    FrameSnapshot &snapshot = snapshots.read_slot();
+    snapshot.apply(w, p, b);
+    over = snapshot.end_game;
+
+    // Snapshots the render thread never took still count, the frame shows the oldest input it includes
+    long long event_ns = 0;
+    while(!unshown.empty() && unshown.front().ff < snapshot.tick){
+        if(event_ns == 0)
+            event_ns = unshown.front().ss;
+        unshown.pop_front();
+    }
+    input_latency.frame(event_ns);
+
+    // Parked, so its generator can be read, the new markers and pickups continue from it
+    if(snapshot.request != SIM_NONE)
+        w.rng = world.rng;
+    return snapshot.request;
+}
+
+void SimThread::resume(Maze &w, Player &p, Player &b){
+    copy_from(w, p, b);
+    parked = false;
+}
+
+void SimThread::loop(){
+    InputState input;
+    while(!quit){
+        if(inputs.pop(input) == EXT_FAIL){
+            std::this_thread::sleep_for(std::chrono::microseconds(SIM_IDLE_US));
+            continue;
+        }
+
+        int request = tick(input);
+        ticks++;
+
+        FrameSnapshot &snapshot = snapshots.write_slot();
+        snapshot.capture(world, player, bot, camera);
+        snapshot.tick = ticks;
+        snapshot.request = request;
+        snapshot.end_game = end_game;
+
+        if(request != SIM_NONE)
+            parked = true;
+        snapshots.publish();
+
+        while(parked && !quit)
+            std::this_thread::sleep_for(std::chrono::microseconds(SIM_IDLE_US));
+    }
+}
+
+// Same rules in the same order as the single threaded loop in game.hpp
+int SimThread::tick(InputState &input){
+    PROFILE_ZONE("phase simulation");
+    apply_input(input, world, player, bot, camera);
+    if(end_game)
+        return SIM_NONE;
+
+    Job *lights = jobs->add("update_lights", [&](){ world.update_lights(player.vertices, player.position); });
+    Job *visibility = jobs->add("update_bot_visibility", [&](){ update_bot_visibility(player, bot, world); });
+    Job *pickups = jobs->add("check_powerups", [&](){ check_powerups(player, world); }, {lights});
+    jobs->wait(visibility);
+    jobs->wait(pickups);
+    jobs->clear();
+
+    lights_off_score(player, world, prev_time);
+
+    if(!bot.dead && remove_bot(player, world)){
+        bot.kill();
+    }
+    if(activate_powerup(player, bot, world)){
+        world.activate_powerups();
+    }
+
+    if(bot_killed_player(player, bot, world))
+        end_game = true;
+
+    if(game_over(player, world)){
+        if(world.tasks < 0)
+            return endless_mode ? SIM_ENDLESS_ROUND : SIM_NEXT_ROUND;
+        end_game = true;
+        return SIM_NONE;
+    }
+
+    if(endless_mode && !end_game && endless_at_edge(world, player))
+        return SIM_SHIFT;
+    return SIM_NONE;
+}
+
+#endif
@@ -0,0 +1,288 @@
+#include "defs.hpp"
+#include "world.hpp"
+
+#ifndef STREAM_H
+#define STREAM_H
+
+
+/*
+    Bit-packed wall rows
+    Every cell takes 2 bits, the low one is its south wall and the high one its east wall
+    The north wall of the first row and the west wall of the first column are always set
+*/
+
+#define WALL_SOUTH_BIT      1
+#define WALL_EAST_BIT       2
+
+// Probability out of 256 that the loop carving removes a wall, about 0.2 like carve_loops
+#define LOOP_CHANCE        53
+
+// Bytes taken by one packed row
+size_t packed_row_bytes(long long columns){
+    return (2*columns + 7)/8;
+}
+
+int packed_walls(const unsigned char *row, long long c){
+    return (row[c >> 2] >> (2*(c & 3))) & 3;
+}
+
+void pack_walls(unsigned char *row, long long c, int walls){
+    row[c >> 2] &= ~(3 << (2*(c & 3)));
+    row[c >> 2] |= walls << (2*(c & 3));
+}
+
+struct WallStreamHeader{
+    char magic[4];
+    unsigned int version;
+    unsigned int seed;
+    unsigned int reserved;
+    unsigned long long rows;
+    unsigned long long columns;
+};
+
+// Receives the generated rows in order
+class RowSink{
+public:
+    virtual ~RowSink(){}
+    virtual int begin(unsigned long long, unsigned long long, unsigned int) = 0;
+    virtual int row(unsigned long long, const unsigned char*) = 0;
+    virtual int end() = 0;
+};
+
+// Writes the header followed by the packed rows
+class RowFile : public RowSink{
+public:
+    FILE *out;
+    size_t row_bytes;
+
+    RowFile(FILE *f){
+        out = f;
+        row_bytes = 0;
+    }
+
+    int begin(unsigned long long, unsigned long long, unsigned int);
+    int row(unsigned long long, const unsigned char*);
+    int end();
+};
+
+int RowFile::begin(unsigned long long rows, unsigned long long columns, unsigned int seed){
+    WallStreamHeader header;
+    memcpy(header.magic, "AMZR", 4);
+    header.version = 1;
+    header.seed = seed;
+    header.reserved = 0;
+    header.rows = rows;
+    header.columns = columns;
+
+    row_bytes = packed_row_bytes(columns);
+
+    if(fwrite(&header, sizeof(header), 1, out) != 1)
+        return EXT_FAIL;
+    return EXT_SUCC;
+}
+
+int RowFile::row(unsigned long long, const unsigned char *data){
+    if(fwrite(data, 1, row_bytes, out) != row_bytes)
+        return EXT_FAIL;
+    return EXT_SUCC;
+}
+
+int RowFile::end(){
+    if(fflush(out) != 0)
+        return EXT_FAIL;
+    return EXT_SUCC;
+}
+
+/*
+    Eller's algorithm
+    Only the set of every cell in the current row is kept, so memory is O(columns) for any number of rows
+    Loop carving happens on each row as it is emitted
+*/
+class EllerStream{
+public:
+    long long rows;
+    long long columns;
+    unsigned int seed;
+    std::mt19937 rng;
+
+    // Set label of every cell in the current row, labels are always below columns
+    std::vector<int> set;
+    // Union-find over labels, reset for every row
+    std::vector<int> parent;
+    // Per label bookkeeping for the vertical connections
+    std::vector<char> opened;
+    std::vector<int> last;
+    std::vector<char> used;
+
+    std::vector<unsigned char> packed;
+
+    // Unused random bits, most decisions need only one or eight of them
+    unsigned int pool;
+    int pool_bits;
+
+    EllerStream(long long r, long long c, unsigned int s){
+        rows = r;
+        columns = c;
+        seed = s;
+        rng.seed(seed);
+        pool = 0;
+        pool_bits = 0;
+    }
+
+    int generate(RowSink&);
+    int find(int);
+    unsigned int bits(int);
+    // Bytes of state held while generating
+    size_t memory();
+};
+
+int EllerStream::find(int x){
+    while(parent[x] != x){
+        parent[x] = parent[parent[x]];
+        x = parent[x];
+    }
+    return x;
+}
+
+unsigned int EllerStream::bits(int n){
+    if(pool_bits < n){
+        pool = rng();
+        pool_bits = 32;
+    }
+    unsigned int ret = pool & ((1u << n) - 1);
+    pool >>= n;
+    pool_bits -= n;
+    return ret;
+}
+
+size_t EllerStream::memory(){
+    return set.capacity()*sizeof(int) + parent.capacity()*sizeof(int) + last.capacity()*sizeof(int)
+        + opened.capacity() + used.capacity() + packed.capacity();
+}
+
+int EllerStream::generate(RowSink &sink){
+    if(rows <= 0 || columns <= 0)
+        return EXT_FAIL;
+
+    set.assign(columns, -1);
+    parent.resize(columns);
+    opened.resize(columns);
+    last.resize(columns);
+    used.resize(columns);
+    packed.resize(packed_row_bytes(columns));
+
+    if(sink.begin(rows, columns, seed) == EXT_FAIL)
+        return EXT_FAIL;
+
+    for(long long r = 0; r<rows; r++){
+        bool last_row = (r == rows-1);
+
+        // Cells that were not joined from above get a label nobody in this row uses
+        std::fill(used.begin(), used.end(), 0);
+        for(long long c = 0; c<columns; c++)
+            if(set[c] != -1)
+                used[set[c]] = 1;
+
+        int free_label = 0;
+        for(long long c = 0; c<columns; c++){
+            if(set[c] != -1)
+                continue;
+            while(used[free_label])
+                free_label++;
+            set[c] = free_label;
+            used[free_label] = 1;
+        }
+
+        for(int i = 0; i<columns; i++)
+            parent[i] = i;
+
+        // Start with every wall in place
+        std::fill(packed.begin(), packed.end(), 0xff);
+        if(columns % 4)
+            packed.back() &= (1 << (2*(columns % 4))) - 1;
+
+        // Join neighbours that belong to different sets, always on the last row
+        for(long long c = 0; c<columns-1; c++){
+            int a = find(set[c]);
+            int b = find(set[c+1]);
+            if(a == b)
+                continue;
+            if(!last_row && bits(1))
+                continue;
+
+            parent[b] = a;
+            pack_walls(&packed[0], c, packed_walls(&packed[0], c) & ~WALL_EAST_BIT);
+        }
+
+        for(long long c = 0; c<columns; c++)
+            set[c] = find(set[c]);
+
+        if(!last_row){
+            // Every set has to continue into the next row through at least one cell
+            for(long long c = 0; c<columns; c++){
+                opened[set[c]] = 0;
+                last[set[c]] = c;
+            }
+
+            for(long long c = 0; c<columns; c++){
+                bool down = bits(1) || (last[set[c]] == c && !opened[set[c]]);
+                if(!down)
+                    continue;
+
+                opened[set[c]] = 1;
+                pack_walls(&packed[0], c, packed_walls(&packed[0], c) & ~WALL_SOUTH_BIT);
+            }
+        }
+
+        // Loop carving in the same pass, extra openings never break the set bookkeeping
+        for(long long c = 0; c<columns; c++){
+            unsigned int roll = bits(16);
+            int walls = packed_walls(&packed[0], c);
+
+            if(c != columns-1 && (roll & 0xff) < LOOP_CHANCE)
+                walls &= ~WALL_EAST_BIT;
+            if(!last_row && (roll >> 8) < LOOP_CHANCE)
+                walls &= ~WALL_SOUTH_BIT;
+
+            pack_walls(&packed[0], c, walls);
+        }
+
+        if(sink.row(r, &packed[0]) == EXT_FAIL)
+            return EXT_FAIL;
+
+        // Cells below an open south wall carry the set on
+        for(long long c = 0; c<columns; c++)
+            if(packed_walls(&packed[0], c) & WALL_SOUTH_BIT)
+                set[c] = -1;
+    }
+
+    return sink.end();
+}
+
+// Reads a packed row file into a maze, only meant for mazes that fit in memory
+int load_wall_rows(FILE *in, Maze &m){
+    WallStreamHeader header;
+    if(fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, "AMZR", 4) != 0)
+        return EXT_FAIL;
+    if(header.rows != (unsigned long long)m.rows || header.columns != (unsigned long long)m.columns)
+        return EXT_FAIL;
+
+    std::vector<unsigned char> row(packed_row_bytes(m.columns));
+
+    for(int i = 0; i<m.rows; i++){
+        if(fread(&row[0], 1, row.size(), in) != row.size())
+            return EXT_FAIL;
+
+        for(int j = 0; j<m.columns; j++){
+            int walls = packed_walls(&row[0], j);
+            if(!(walls & WALL_SOUTH_BIT))
+                m.path(i, j, SOUTH);
+            if(!(walls & WALL_EAST_BIT))
+                m.path(i, j, EAST);
+        }
+    }
+
+    return EXT_SUCC;
+}
+
+#endif
@@ -0,0 +1,294 @@
+#include "defs.hpp"
+#include "world.hpp"
+#include "stream.hpp"
+#include "graphics_setup.hpp"
+
+#ifndef WALLPASS_H
+#define WALLPASS_H
+
+
+/*
+    Procedural maze rendering
+    Every cell is one texel of an integer texture holding its south and east walls (see stream.hpp) and the
+    markers on it, a single full screen triangle then draws walls, markers and the lights off fog from it
+    The vertex work no longer depends on the maze size and changing a cell is a one texel upload
+*/
+
+#define MARK_END            4
+#define MARK_BOT_KILL       8
+#define MARK_POWERUP       16
+#define MARK_PICKUP_GOOD   32
+#define MARK_PICKUP_BAD    64
+
+const char *wallPassVertexSource = "#version 330 core\n"
+    "uniform vec2 camera;\n"
+    "out vec2 world;\n"
+    "void main()\n"
+    "{\n"
+    "   // One triangle covering the whole screen\n"
+    "   vec2 ndc = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2)*2.0 - 1.0;\n"
+    "   gl_Position = vec4(ndc, 0.0, 1.0);\n"
+    "   world = ndc + camera;\n"
+    "}\0";
+
+const char *wallPassFragmentSource = "#version 330 core\n"
+    "out vec4 FragColor;\n"
+    "in vec2 world;\n"
+    "uniform usampler2D walls;\n"
+    "uniform usampler2D fog;\n"
+    "uniform vec2 origin;\n"
+    "uniform vec2 cell;\n"
+    "uniform ivec2 size;\n"
+    "uniform float thickness;\n"
+    "uniform int lights;\n"
+    "uniform float gradient;\n"
+    "bool inside(ivec2 c){ return all(greaterThanEqual(c, ivec2(0))) && all(lessThan(c, size)); }\n"
+    "uint bits(ivec2 c){ return inside(c) ? texelFetch(walls, c, 0).r : 0u; }\n"
+    "float light(ivec2 c){\n"
+    "   if(lights != 0) return 1.0;\n"
+    "   if(!inside(c)) return 0.0;\n"
+    "   return max(0.0, 1.0 - gradient*float(texelFetch(fog, c, 0).r));\n"
+    "}\n"
+    "void main()\n"
+    "{\n"
+    "   // x is the column and y the row, both counted in cells from the top left corner\n"
+    "   vec2 p = vec2(world.x - origin.x, origin.y - world.y)/cell;\n"
+    "   ivec2 c = ivec2(floor(p));\n"
+    "   if(!inside(c)) discard;\n"
+    "   vec2 f = p - vec2(c);\n"
+    "   vec2 line = fwidth(p)*thickness;\n"
+    "   uint own = bits(c);\n"
+    "   // The north and west walls are the south and east walls of the neighbours, the border is always a wall\n"
+    "   bool north = c.y == 0 || (bits(c - ivec2(0, 1)) & 1u) != 0u;\n"
+    "   bool west = c.x == 0 || (bits(c - ivec2(1, 0)) & 2u) != 0u;\n"
+    "   bool south = (own & 1u) != 0u;\n"
+    "   bool east = (own & 2u) != 0u;\n"
+    "   ivec2 other = c;\n"
+    "   bool wall = false;\n"
+    "   if(north && f.y < line.y){ wall = true; other = c - ivec2(0, 1); }\n"
+    "   if(south && 1.0 - f.y < line.y){ wall = true; other = c + ivec2(0, 1); }\n"
+    "   if(west && f.x < line.x){ wall = true; other = c - ivec2(1, 0); }\n"
+    "   if(east && 1.0 - f.x < line.x){ wall = true; other = c + ivec2(1, 0); }\n"
+    "   if(wall){\n"
+    "       float l = max(light(c), light(other));\n"
+    "       FragColor = vec4(0.0, l, l, 1.0);\n"
+    "       return;\n"
+    "   }\n"
+    "   vec2 d = abs(f - 0.5);\n"
+    "   float r = max(d.x, d.y);\n"
+    "   vec3 color = vec3(0.0);\n"
+    "   if((own & 4u) != 0u && r < 1.0/3.0) color = vec3(0.19, 0.90, 0.37);\n"
+    "   else if((own & 8u) != 0u && r < 1.0/3.0) color = vec3(0.90, 0.00, 0.30);\n"
+    "   else if((own & 16u) != 0u && r < 1.0/3.0) color = vec3(0.90, 0.90, 0.00);\n"
+    "   else if((own & 32u) != 0u && r < 0.25) color = vec3(0.00, 0.50, 0.50);\n"
+    "   else if((own & 64u) != 0u && r < 0.25) color = vec3(1.00, 0.20, 0.20);\n"
+    "   else discard;\n"
+    "   FragColor = vec4(color*light(c), 1.0);\n"
+    "}\n\0";
+
+class WallPass{
+public:
+    unsigned int program;
+    // The triangle is made up in the vertex shader, the VAO is only there because core profile needs one bound
+    unsigned int vao;
+    unsigned int wall_texture;
+    unsigned int fog_texture;
+
+    // Layout the textures were last built for
+    int rows;
+    int columns;
+    unsigned int seed;
+    int builds;
+    // Maze::color_version the fog was last sent for
+    int fog_version;
+
+    std::vector<unsigned char> texels;
+    // Cells holding a marker in the last frame and the bit it set
+    std::vector<std::pair<std::pair<int, int>, int>> marks;
+
+    WallPass(){
+        program = 0;
+        vao = 0;
+        wall_texture = 0;
+        fog_texture = 0;
+        rows = 0;
+        columns = 0;
+        seed = 0;
+        builds = -1;
+        fog_version = -1;
+    }
+
+    int init();
+    void release();
+
+    // Marker cells of the maze as ((row, column), bit)
+    std::vector<std::pair<std::pair<int, int>, int>> markers(Maze&);
+    unsigned char texel(Maze&, int, int);
+
+    // Sends every cell again, only needed when the maze is replaced
+    int upload(Maze&);
+    // Sends one cell again after its walls or markers changed
+    int update(Maze&, int, int);
+
+    int draw(Maze&);
+};
+
+int WallPass::init(){
+    program = build_program(wallPassVertexSource, wallPassFragmentSource);
+    if(program == 0)
+        return EXT_FAIL;
+
+    glGenVertexArrays(1, &vao);
+    glGenTextures(1, &wall_texture);
+    glGenTextures(1, &fog_texture);
+
+    unsigned int textures[2] = {wall_texture, fog_texture};
+    for(int i = 0; i<2; i++){
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+        // Integer textures can not be filtered
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+
+    return EXT_SUCC;
+}
+
+void WallPass::release(){
+    if(program == 0)
+        return;
+    glDeleteProgram(program);
+    glDeleteVertexArrays(1, &vao);
+    glDeleteTextures(1, &wall_texture);
+    glDeleteTextures(1, &fog_texture);
+    program = 0;
+    builds = -1;
+}
+
+std::vector<std::pair<std::pair<int, int>, int>> WallPass::markers(Maze &world){
+    std::vector<std::pair<std::pair<int, int>, int>> ret;
+
+    ret.push_back(std::make_pair(std::make_pair(world.end.ss, world.end.ff), MARK_END));
+    ret.push_back(std::make_pair(std::make_pair(world.bot_kill.ss, world.bot_kill.ff), MARK_BOT_KILL));
+    ret.push_back(std::make_pair(std::make_pair(world.powerup.ss, world.powerup.ff), MARK_POWERUP));
+
+    for(int i = 0; i<world.powerup_pos.size(); i++){
+        if(world.powerup_pos[i].ss == -1)
+            continue;
+        int bit = world.powerup_pos[i].ss == 0 ? MARK_PICKUP_GOOD : MARK_PICKUP_BAD;
+        ret.push_back(std::make_pair(std::make_pair(world.powerup_pos[i].ff.ss, world.powerup_pos[i].ff.ff), bit));
+    }
+
+    return ret;
+}
+
+unsigned char WallPass::texel(Maze &world, int r, int c){
+    unsigned char ret = 0;
+    if(world.maze[r][c].south == WALL)
+        ret |= WALL_SOUTH_BIT;
+    if(world.maze[r][c].east == WALL)
+        ret |= WALL_EAST_BIT;
+
+    for(int i = 0; i<marks.size(); i++)
+        if(marks[i].ff.ff == r && marks[i].ff.ss == c)
+            ret |= marks[i].ss;
+
+    return ret;
+}
+
+int WallPass::upload(Maze &world){
+    rows = world.rows;
+    columns = world.columns;
+    seed = world.seed;
+    builds = world.builds;
+    fog_version = -1;
+    marks = markers(world);
+
+    texels.resize(rows*columns);
+    for(int i = 0; i<rows; i++)
+        for(int j = 0; j<columns; j++)
+            texels[i*columns+j] = texel(world, i, j);
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    glBindTexture(GL_TEXTURE_2D, wall_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8UI, columns, rows, 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, &texels[0]);
+
+    // Fully lit until the first distance field arrives
+    std::vector<unsigned char> lit(rows*columns, 0);
+    glBindTexture(GL_TEXTURE_2D, fog_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8UI, columns, rows, 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, &lit[0]);
+
+    return EXT_SUCC;
+}
+
+int WallPass::update(Maze &world, int r, int c){
+    if(r < 0 || r >= rows || c < 0 || c >= columns)
+        return EXT_FAIL;
+
+    unsigned char value = texel(world, r, c);
+    if(texels[r*columns+c] == value)
+        return EXT_SUCC;
+    texels[r*columns+c] = value;
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glBindTexture(GL_TEXTURE_2D, wall_texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, c, r, 1, 1, GL_RED_INTEGER, GL_UNSIGNED_BYTE, &value);
+
+    return EXT_SUCC;
+}
+
+int WallPass::draw(Maze &world){
+    if(program == 0 && init() == EXT_FAIL)
+        return EXT_FAIL;
+
+    if(world.builds != builds || world.seed != seed || world.rows != rows || world.columns != columns)
+        upload(world);
+
+    // Markers move rarely, only the cells they left or reached are sent
+    std::vector<std::pair<std::pair<int, int>, int>> now = markers(world);
+    if(now != marks){
+        std::vector<std::pair<std::pair<int, int>, int>> old = marks;
+        marks = now;
+        for(int i = 0; i<old.size(); i++)
+            update(world, old[i].ff.ff, old[i].ff.ss);
+        for(int i = 0; i<now.size(); i++)
+            update(world, now[i].ff.ff, now[i].ff.ss);
+    }
+
+    if(!world.lights && world.light_dist.size() == rows*columns && world.color_version != fog_version){
+        fog_version = world.color_version;
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glBindTexture(GL_TEXTURE_2D, fog_texture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, columns, rows, GL_RED_INTEGER, GL_UNSIGNED_BYTE, &world.light_dist[0]);
+    }
+
+    glUseProgram(program);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, wall_texture);
+    glUniform1i(glGetUniformLocation(program, "walls"), 0);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, fog_texture);
+    glUniform1i(glGetUniformLocation(program, "fog"), 1);
+    glActiveTexture(GL_TEXTURE0);
+
+    // Same corner build_geometry puts the first wall vertex at
+    glUniform2f(glGetUniformLocation(program, "origin"), -width*rows/2, height*columns/2);
+    glUniform2f(glGetUniformLocation(program, "cell"), width, height);
+    glUniform2i(glGetUniformLocation(program, "size"), columns, rows);
+    glUniform2f(glGetUniformLocation(program, "camera"), cameraPos.x, cameraPos.y);
+    // Both cells next to a wall draw their half of it
+    glUniform1f(glGetUniformLocation(program, "thickness"), max(0.5f, wall_thickness/2));
+    glUniform1i(glGetUniformLocation(program, "lights"), world.lights ? 1 : 0);
+    glUniform1f(glGetUniformLocation(program, "gradient"), GRADIENT);
+
+    glBindVertexArray(vao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+
+    return EXT_SUCC;
+}
+
+#endif
@@ -1,4 +1,6 @@
 #include "defs.hpp"
+#include "batch.hpp"
+#include "profile.hpp"
 
 #ifndef WORLD_H
 #define WORLD_H
@@ -20,6 +22,7 @@ public:
     }
 
     int path(int);
+    int wall(int);
 };
 
 // Adds a pathway in the specified direction
@@ -37,6 +40,104 @@ int Node::path(int dir){
     return EXT_SUCC; 
 }
 
+// Puts a wall back in the specified direction
+int Node::wall(int dir){
+    if(dir == NORTH)
+        north = WALL;
+    else if(dir == SOUTH)
+        south = WALL;
+    else if(dir == EAST)
+        east = WALL;
+    else if(dir == WEST)
+        west = WALL;
+    else 
+        return EXT_FAIL;
+    return EXT_SUCC; 
+}
+
+class Maze;
+class MazeFile;
+class ChunkWorld;
+
+// Walls of a block of cells with their own buffers, so only the blocks on screen get drawn
+class WallChunk{
+public:
+    // Cells [r0, r1) x [c0, c1)
+    int r0;
+    int c0;
+    int r1;
+    int c1;
+
+    // Start and end of every merged wall run, as indices into the chunk's own (r1-r0+1) x (c1-c0+1) corners
+    std::vector<unsigned int> runs;
+    // Thickness in pixels, 0 draws the runs as lines and anything else as quads with 4 vertices each
+    float thickness;
+    // A chunk never has more than 65536 vertices
+    std::vector<unsigned short> indices;
+
+    // World space bounds used for culling
+    float x_min;
+    float x_max;
+    float y_min;
+    float y_max;
+
+    unsigned int vao;
+    // Positions never change after upload, colors follow the lights
+    unsigned int vbo;
+    unsigned int color_vbo;
+    unsigned int ebo;
+
+    // Colors last sent to color_vbo, RGBA bytes per vertex
+    std::vector<unsigned char> colors;
+    // Maze::color_version they were taken at
+    int color_version;
+
+    WallChunk(){
+        r0 = c0 = r1 = c1 = 0;
+        x_min = x_max = y_min = y_max = 0;
+        thickness = 0;
+        vao = vbo = color_vbo = ebo = 0;
+        color_version = -1;
+    }
+
+    int corners(){
+        return (r1-r0+1)*(c1-c0+1);
+    }
+
+    int vertices(){
+        return thickness > 0 ? runs.size()*2 : corners();
+    }
+
+    GLenum mode(){
+        return thickness > 0 ? GL_TRIANGLES : GL_LINES;
+    }
+
+    bool visible(glm::vec3);
+};
+
+// Without a projection the view spans one unit on every side of the camera
+bool WallChunk::visible(glm::vec3 camera){
+    return x_max >= camera.x-1.0f && x_min <= camera.x+1.0f && y_max >= camera.y-1.0f && y_min <= camera.y+1.0f;
+}
+
+// Algorithm that turns a grid full of walls into a perfect maze
+class Generator{
+public:
+    // Scratch memory used by the last run, in bytes
+    size_t memory;
+
+    Generator(){
+        memory = 0;
+    }
+    virtual ~Generator(){}
+
+    virtual const char *name() = 0;
+    virtual int generate(Maze&) = 0;
+};
+
+// Returns the engine for one of the GEN_ constants
+Generator *make_generator(int);
+
 class Maze{
 public:
     std::vector<std::vector<Node>> maze;
@@ -47,7 +148,15 @@ public:
     int tasks;
 
     std::vector<GLfloat> wall_vertices;
-    std::vector<unsigned int> wall_indices;
+    std::vector<WallChunk> wall_chunks;
+    // Wall edges in the maze and the runs they were merged into
+    int wall_edges;
+    int wall_runs;
+    // Times the geometry was rebuilt, lets other renderers notice a new layout
+    int builds;
+
+    // Distance of every cell from the player while the lights are off, capped at 255
+    std::vector<unsigned char> light_dist;
 
     std::vector<GLfloat> end_vertices;
     std::vector<unsigned int> end_indices; 
@@ -70,10 +179,37 @@ public:
     bool powerup_activated;
 
     std::vector<std::pair<std::pair<int, int>, int>> powerup_pos;
-
-    Maze(int r, int c){
+    // Pickups read from a maze file, placed instead of random ones once the powerup task is done
+    std::vector<std::pair<std::pair<int, int>, int>> saved_pickups;
+
+    // Every maze carries its own generator so it can be built off the main thread
+    unsigned int seed;
+    std::mt19937 rng;
+
+    // Which generator init uses, one of the GEN_ constants
+    int engine;
+
+    // Wall chunks live in buffers owned by the maze, created a few at a time by upload
+    int uploaded_chunks;
+    bool uploaded;
+    // Chunks drawn in the last frame
+    int visible_chunks;
+    // Scratch for gather_chunk, positions are two int16 in GRID_UNITS per cell from the chunk's first corner
+    std::vector<short> chunk_positions;
+    std::vector<unsigned char> chunk_colors;
+
+    // Bumped whenever update_lights changes a color
+    int color_version;
+    // Player cell, lights and layout the colors were last computed for
+    std::vector<int> light_key;
+
+    Maze(int r, int c, unsigned int s = time(0), int e = GEN_BACKTRACKER){
         rows = r;
         columns = c;
+
+        seed = s;
+        rng.seed(seed);
+        engine = e;
         
         maze = std::vector<std::vector<Node>>(rows, std::vector<Node>(columns));
 
@@ -81,18 +217,48 @@ public:
         tasks = 2;
 
         powerup_activated = false;
+
+        uploaded_chunks = 0;
+        uploaded = false;
+        visible_chunks = 0;
+        wall_edges = 0;
+        wall_runs = 0;
+        builds = 0;
+        color_version = 0;
     }
 
     // Function to add a path in the maze
     int path(int, int, int);
+    // Function to add a wall back into the maze
+    int wall(int, int, int);
+    // Removes extra walls so the maze has loops
+    void carve_loops();
+    // Picks the cells of the end, bot kill and powerup tiles
+    void place_markers();
+    // Builds the wall and marker vertices from the grid
+    int build_geometry();
+    // Builds only the end, bot kill and powerup quads, the walls are left as they are
+    int build_markers();
+    // Merges the walls of a chunk's cells into straight runs
+    void build_chunk(WallChunk&);
     // Function to generate a maze procedurally
     int init();
 
     int draw(unsigned int, GLFWwindow*);
 
+    // Uploads about the given number of bytes of wall chunks, EXT_SUCC once all of them are on the GPU
+    int upload(size_t);
+    void release();
+    // Packs the current colors, and the positions if asked, of a chunk's corners or wall quads into the scratch buffers
+    void gather_chunk(WallChunk&, bool);
+    // Sends the part of a chunk's colors that changed since it was last drawn
+    void update_colors(WallChunk&);
+
     int can_move(std::vector<GLfloat>, glm::vec3, int);
 
     std::pair<std::pair<int, int>, std::pair<int, int>> get_bounds(std::vector<float>, glm::vec3);
+    // True when every cell the hull touches is inside the grid
+    bool contains(std::vector<float>, glm::vec3);
 
     int update_lights(std::vector<float>, glm::vec3);
 
@@ -102,6 +268,17 @@ public:
     int shortest_path(std::vector<float>, glm::vec3, std::vector<float>, glm::vec3);
 
     void activate_powerups();
+    // Adds one pickup, kind 0 raises the score and kind 1 lowers it
+    void add_pickup(int, int, int);
+
+    // Writes the maze to a chunked maze file
+    int save(const char*);
+    // Fills the maze from the window of a mapped file starting at the given row and column
+    int load(MazeFile&, long long, long long);
+    // Same for a window of the endless world, defined in endless.hpp
+    int load(ChunkWorld&, long long, long long);
+    // Moves the markers and pickups along when the window moves, the ones that fall off are placed again
+    void shift_markers(int, int);
 };
 
 int Maze::path(int r, int c, int dir){
@@ -139,80 +316,94 @@ int Maze::path(int r, int c, int dir){
     return EXT_SUCC;
 }
 
-int Maze::init(){
-    // Visited array for maze generation
-    std::vector<std::vector<bool>> vis(rows, std::vector<bool>(columns, false));
-    // Stack to memorize path
-    std::stack<std::pair<int, int>> st;
+int Maze::wall(int r, int c, int dir){
+    if(dir == NORTH){
+        if(r == 0)
+            return EXT_FAIL;
+        
+        maze[r][c].wall(NORTH);
+        maze[r-1][c].wall(SOUTH);
+    }
+    else if(dir == SOUTH){
+        if(r == rows-1)
+            return EXT_FAIL;
+        
+        maze[r][c].wall(SOUTH);
+        maze[r+1][c].wall(NORTH);
+    }
+    else if(dir == WEST){
+        if(c == 0)
+            return EXT_FAIL;
+        
+        maze[r][c].wall(WEST);
+        maze[r][c-1].wall(EAST);
+    }
+    else if(dir == EAST){
+        if(c == columns-1)
+            return EXT_FAIL;
+    
+        maze[r][c].wall(EAST);
+        maze[r][c+1].wall(WEST);
+    }
+    else
+        return EXT_FAIL;
+    
+    return EXT_SUCC;
+}
 
-    // Set seed for random number generator
-    srand(time(0));
+void Maze::carve_loops(){
+    // One draw per cell, each byte decides one wall with probability 28/256
+    // Each wall is considered from both of its cells, so about 0.2 of them are removed
+    for(int i = 0; i<rows; i++){
+        for(int j = 0; j<columns; j++){
+            unsigned int r = rng();
+
+            if(i != 0 && (r & 0xff) < 28)
+                path(i, j, NORTH);
+            if(i != rows-1 && ((r >> 8) & 0xff) < 28)
+                path(i, j, SOUTH);
+            if(j != 0 && ((r >> 16) & 0xff) < 28)
+                path(i, j, WEST);
+            if(j != columns-1 && ((r >> 24) & 0xff) < 28)
+                path(i, j, EAST);
+        }
+    }
+}
 
-    // Start at random location
-    st.push(std::make_pair(rand() % rows, rand() % columns));
+int Maze::init(){
+    Generator *generator = make_generator(engine);
+    if(generator == NULL)
+        return EXT_FAIL;
 
     // Generate a perfect maze
-    while(!st.empty()) {
-        std::vector<int> dir;
+    generator->generate(*this);
+    delete generator;
 
-        std::pair<int, int> cur = st.top();
-        
-        
-        vis[cur.ff][cur.ss] = true;
-
-        if(cur.ff != 0 && vis[cur.ff-1][cur.ss] == false)
-            dir.push_back(NORTH);
-        if(cur.ff != rows-1 && vis[cur.ff+1][cur.ss] == false)
-            dir.push_back(SOUTH);
-        if(cur.ss != 0 && vis[cur.ff][cur.ss-1] == false)
-            dir.push_back(WEST);
-        if(cur.ss != columns-1 && vis[cur.ff][cur.ss+1] == false)
-            dir.push_back(EAST);
-        
-        if(dir.size() == 0){
-            st.pop();
-            continue;
-        }
+    // Arbitrarily carve pathways
+    carve_loops();
+
+    place_markers();
+
+    return build_geometry();
+}
 
-        int sel = dir[rand() % dir.size()];
-        path(cur.ff, cur.ss, sel);
-      
-        if(sel == NORTH)
-            st.push(std::make_pair(cur.ff-1, cur.ss));
-        if(sel == SOUTH)
-            st.push(std::make_pair(cur.ff+1, cur.ss));
-        if(sel == WEST)
-            st.push(std::make_pair(cur.ff, cur.ss-1));
-        if(sel == EAST)
-            st.push(std::make_pair(cur.ff, cur.ss+1));
+void Maze::place_markers(){
+    end = std::make_pair(rng() % MAZE_WIDTH, rng() % MAZE_HEIGHT);
 
+    bot_kill = std::make_pair(rng() % MAZE_WIDTH, rng() % MAZE_HEIGHT);
 
-        dir.clear();
+    while(bot_kill.ff == end.ff && bot_kill.ss == end.ss){
+        bot_kill = std::make_pair(rng() % MAZE_WIDTH, rng() % MAZE_HEIGHT);
     }
 
-    // Arbitrarily carve pathways
-    // Each wall has 0.2 probability of being removed
-    for(int i = 0; i<rows; i++){
-        for(int j = 0; j<columns; j++){
-            if(i != 0){
-                if(rand()%9 < 1)
-                    path(i, j, NORTH);
-            }
-            if(i != rows-1){
-                if(rand()%9 < 1)
-                    path(i, j, SOUTH);
-            }
-            if(j != 0){
-                if(rand()%9 < 1)
-                    path(i, j, WEST);
-            }
-            if(j != columns-1){
-                if(rand()%9 < 1)
-                    path(i, j, EAST);
-            }
-        }
+    powerup = std::make_pair(rng() % MAZE_WIDTH, rng() % MAZE_HEIGHT);
+
+    while((powerup.ff == end.ff && powerup.ss == end.ss) || (powerup.ff == bot_kill.ff && powerup.ss == bot_kill.ss)){
+        powerup = std::make_pair(rng() % MAZE_WIDTH, rng() % MAZE_HEIGHT);
     }
+}
 
+int Maze::build_geometry(){
     /*
         The maze's centre is at 0, 0
         The cell width is given in terms of pixels and is scaled accordingly
@@ -224,6 +415,11 @@ int Maze::init(){
     float y = height*columns/2;
     float x = -width*rows/2;
 
+    wall_vertices.clear();
+    wall_chunks.clear();
+    wall_edges = 0;
+    wall_runs = 0;
+
     // Adding the wall terminal points positions
     for(int i = 0; i<=rows; i++){
         for(int j = 0; j<=columns; j++){
@@ -233,26 +429,53 @@ int Maze::init(){
         y -= height;
     }
 
-    // Adding the walls to the buffer
-    for(unsigned int i = 0; i<rows; i++){
-        for(unsigned int j = 0; j<columns; j++){
-            if(maze[i][j].north == WALL)
-                wall_indices.insert(wall_indices.end(), {((columns+1)*i+j), ((columns+1)*i+j+1)});
-            
-            if(maze[i][j].west == WALL)
-                wall_indices.insert(wall_indices.end(), {((columns+1)*i+j), ((columns+1)*i+j+columns+1)}); 
-            
-            if(j == columns-1 && maze[i][j].east == WALL)
-                wall_indices.insert(wall_indices.end(), {((columns+1)*i+j+1), ((columns+1)*i+j+1+columns+1)});
-            
-            if(i == rows-1 && maze[i][j].south == WALL)
-                wall_indices.insert(wall_indices.end(), {((columns+1)*i+j+columns+1), ((columns+1)*i+j+1+columns+1)});
+    // Adding the walls to the chunk buffers, every cell belongs to exactly one chunk
+    for(int cr = 0; cr<rows; cr+=MESH_CHUNK){
+        for(int cc = 0; cc<columns; cc+=MESH_CHUNK){
+            WallChunk chunk;
+            chunk.r0 = cr;
+            chunk.c0 = cc;
+            chunk.r1 = min(cr+MESH_CHUNK, rows);
+            chunk.c1 = min(cc+MESH_CHUNK, columns);
+
+            chunk.thickness = wall_thickness;
+            build_chunk(chunk);
+
+            int first = ((columns+1)*chunk.r0 + chunk.c0)*6;
+            int last = ((columns+1)*chunk.r1 + chunk.c1)*6;
+            chunk.x_min = min(wall_vertices[first], wall_vertices[last]);
+            chunk.x_max = max(wall_vertices[first], wall_vertices[last]);
+            chunk.y_min = min(wall_vertices[first+1], wall_vertices[last+1]);
+            chunk.y_max = max(wall_vertices[first+1], wall_vertices[last+1]);
+
+            // Quads stick out by half their thickness
+            chunk.x_min -= chunk.thickness/SCR_WIDTH;
+            chunk.x_max += chunk.thickness/SCR_WIDTH;
+            chunk.y_min -= chunk.thickness/SCR_HEIGHT;
+            chunk.y_max += chunk.thickness/SCR_HEIGHT;
+
+            wall_chunks.push_back(chunk);
         }
     }
 
-    end = std::make_pair(rand() % MAZE_WIDTH, rand() % MAZE_HEIGHT);
+    return build_markers();
+}
+
+int Maze::build_markers(){
+    float height = (float)CELL_WIDTH/SCR_HEIGHT;
+    float width = (float)CELL_WIDTH/SCR_WIDTH;
 
-    x = width * (end.ff - MAZE_WIDTH/2);
+    // Makes the light and wall pass caches pick up the new markers
+    builds++;
+    end_vertices.clear();
+    end_indices.clear();
+    bot_kill_vertices.clear();
+    bot_kill_indices.clear();
+    powerup_vertices.clear();
+    powerup_indices.clear();
+
+    float x = width * (end.ff - MAZE_WIDTH/2);
+    float y = height * (MAZE_HEIGHT/2 - end.ss);
     y = height * (MAZE_HEIGHT/2 - end.ss);
 
     for(int i = -1; i<=1; i+=2){
@@ -264,12 +487,6 @@ int Maze::init(){
     for(unsigned int i = 0; i<2; i++)
         end_indices.insert(end_indices.end(), {i, i+1, i+2});
 
-    bot_kill = std::make_pair(rand() % MAZE_WIDTH, rand() % MAZE_HEIGHT);
-
-    while(bot_kill.ff == end.ff && bot_kill.ss == end.ss){
-        bot_kill = std::make_pair(rand() % MAZE_WIDTH, rand() % MAZE_HEIGHT);
-    }
-
     x = width * (bot_kill.ff - MAZE_WIDTH/2);
     y = height * (MAZE_HEIGHT/2 - bot_kill.ss);
 
@@ -282,12 +499,6 @@ int Maze::init(){
     for(unsigned int i = 0; i<2; i++)
         bot_kill_indices.insert(bot_kill_indices.end(), {i, i+1, i+2});
 
-    powerup = std::make_pair(rand() % MAZE_WIDTH, rand() % MAZE_HEIGHT);
-
-    while((powerup.ff == end.ff && powerup.ss == end.ss) || (powerup.ff == bot_kill.ff && powerup.ss == bot_kill.ss)){
-        powerup = std::make_pair(rand() % MAZE_WIDTH, rand() % MAZE_HEIGHT);
-    }
-
     x = width * (powerup.ff - MAZE_WIDTH/2);
     y = height * (MAZE_HEIGHT/2 - powerup.ss);
 
@@ -303,84 +514,281 @@ int Maze::init(){
     return EXT_SUCC;
 }
 
-int Maze::draw(unsigned int shaderProgram, GLFWwindow *window){
-    unsigned int VBO, VAO, EBO;
+void Maze::build_chunk(WallChunk &chunk){
+    unsigned int stride = chunk.c1 - chunk.c0 + 1;
+    chunk.runs.clear();
 
-    glUseProgram(shaderProgram);
+    /*
+        Every wall edge belongs to the chunk of the cell north or west of it, the south and east border of the maze
+        to the chunks along it
+        Collinear edges next to each other become one run, a run never crosses into another chunk
+    */
 
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
-    glGenBuffers(1, &EBO);
-    // first parameter is for number of buffer objects to create
-    // bind the Vertex Array Object first, then bind and set vertex buffer(s), and then configure vertex attributes(s).
-    glBindVertexArray(VAO);
+    // Horizontal lines of corners, the south border is the line past the last row
+    int last_row = chunk.r1 == rows ? rows : chunk.r1-1;
+    for(int i = chunk.r0; i<=last_row; i++){
+        int start = -1;
+        for(int j = chunk.c0; j<=chunk.c1; j++){
+            bool wall = false;
+            if(j < chunk.c1)
+                wall = (i < rows ? maze[i][j].north : maze[i-1][j].south) == WALL;
+
+            if(wall){
+                wall_edges++;
+                if(start == -1)
+                    start = j;
+            }
+            else if(start != -1){
+                unsigned int corner = (i-chunk.r0)*stride;
+                chunk.runs.insert(chunk.runs.end(), {corner + start-chunk.c0, corner + j-chunk.c0});
+                start = -1;
+            }
+        }
+    }
 
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, wall_vertices.size()*sizeof(GLfloat), &wall_vertices[0], GL_DYNAMIC_DRAW);
+    // Vertical lines of corners, the east border is the line past the last column
+    int last_column = chunk.c1 == columns ? columns : chunk.c1-1;
+    for(int j = chunk.c0; j<=last_column; j++){
+        int start = -1;
+        for(int i = chunk.r0; i<=chunk.r1; i++){
+            bool wall = false;
+            if(i < chunk.r1)
+                wall = (j < columns ? maze[i][j].west : maze[i][j-1].east) == WALL;
+
+            if(wall){
+                wall_edges++;
+                if(start == -1)
+                    start = i;
+            }
+            else if(start != -1){
+                unsigned int corner = j-chunk.c0;
+                chunk.runs.insert(chunk.runs.end(), {corner + (start-chunk.r0)*stride, corner + (i-chunk.r0)*stride});
+                start = -1;
+            }
+        }
+    }
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, wall_indices.size()*sizeof(unsigned int), &wall_indices[0], GL_DYNAMIC_DRAW);
+    wall_runs += chunk.runs.size()/2;
 
-    // position attribute
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-    // color attribute
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
+    if(chunk.thickness > 0){
+        // Two triangles over the 4 vertices of every run
+        chunk.indices.clear();
+        for(unsigned short k = 0; k<chunk.runs.size()/2; k++){
+            unsigned short quad[6] = {(unsigned short)(4*k), (unsigned short)(4*k+1), (unsigned short)(4*k+2), (unsigned short)(4*k+2), (unsigned short)(4*k+1), (unsigned short)(4*k+3)};
+            chunk.indices.insert(chunk.indices.end(), quad, quad+6);
+        }
+    }
+    else
+        chunk.indices.assign(chunk.runs.begin(), chunk.runs.end());
+}
 
+void Maze::gather_chunk(WallChunk &chunk, bool positions){
+    int stride = chunk.c1 - chunk.c0 + 1;
+    chunk_colors.resize(chunk.vertices()*4);
+    if(positions)
+        chunk_positions.resize(chunk.vertices()*2);
+
+    if(chunk.thickness <= 0){
+        for(int i = chunk.r0; i<=chunk.r1; i++){
+            for(int j = chunk.c0; j<=chunk.c1; j++){
+                int v = (i-chunk.r0)*stride + (j-chunk.c0);
+                int from = ((columns+1)*i + j)*6;
+                for(int c = 0; c<3; c++)
+                    chunk_colors[4*v+c] = wall_vertices[from+3+c]*255.0f + 0.5f;
+                chunk_colors[4*v+3] = 255;
+
+                if(positions){
+                    chunk_positions[2*v] = (j-chunk.c0)*GRID_UNITS;
+                    chunk_positions[2*v+1] = (i-chunk.r0)*GRID_UNITS;
+                }
+            }
+        }
+        return;
+    }
 
-    // the model and view matrices, 
-    glm::mat4 model = glm::mat4(1.0f);
+    // Half the thickness in grid units, the same on both axes since cells are CELL_WIDTH pixels both ways
+    int half = chunk.thickness*GRID_UNITS/CELL_WIDTH + 0.5f;
+
+    // The quad of a run is its line widened on both sides and stretched over the corners, each end keeps the color of its corner
+    for(int k = 0; k<chunk.runs.size()/2; k++){
+        int ends[2] = {(int)chunk.runs[2*k], (int)chunk.runs[2*k+1]};
+        bool horizontal = ends[0]/stride == ends[1]/stride;
+        int along_x = horizontal ? half : 0;
+        int along_y = horizontal ? 0 : half;
+
+        for(int e = 0; e<2; e++){
+            int sign = e == 0 ? -1 : 1;
+            int x = (ends[e]%stride)*GRID_UNITS;
+            int y = (ends[e]/stride)*GRID_UNITS;
+            int from = ((columns+1)*(chunk.r0 + ends[e]/stride) + chunk.c0 + ends[e]%stride)*6;
+
+            for(int side = -1; side<=1; side+=2){
+                int v = 4*k + 2*e + (side+1)/2;
+                for(int c = 0; c<3; c++)
+                    chunk_colors[4*v+c] = wall_vertices[from+3+c]*255.0f + 0.5f;
+                chunk_colors[4*v+3] = 255;
+
+                if(positions){
+                    chunk_positions[2*v] = x + sign*along_x + side*along_y;
+                    chunk_positions[2*v+1] = y + sign*along_y + side*along_x;
+                }
+            }
+        }
+    }
+}
 
-    // make the camera look in the 'front' direction
-    glm::mat4 view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
+void Maze::update_colors(WallChunk &chunk){
+    if(chunk.color_version == color_version)
+        return;
+    chunk.color_version = color_version;
+
+    gather_chunk(chunk, false);
+
+    // Only the span between the first and last changed vertex is sent
+    int first = 0;
+    int last = chunk_colors.size();
+    while(first < last && chunk_colors[first] == chunk.colors[first])
+        first++;
+    while(last > first && chunk_colors[last-1] == chunk.colors[last-1])
+        last--;
+    if(first == last)
+        return;
+
+    first -= first%4;
+    last += (4 - last%4)%4;
+    std::copy(chunk_colors.begin()+first, chunk_colors.begin()+last, chunk.colors.begin()+first);
+
+    glBindBuffer(GL_ARRAY_BUFFER, chunk.color_vbo);
+    glBufferSubData(GL_ARRAY_BUFFER, first, last-first, &chunk.colors[first]);
+}
 
-    // assign the uniform values for model and view matrices
-    unsigned int modelLoc = glGetUniformLocation(shaderProgram, "model");
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+int Maze::upload(size_t budget){
+    bool first = true;
 
-    unsigned int viewLoc = glGetUniformLocation(shaderProgram, "view");
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
+    while(uploaded_chunks < wall_chunks.size()){
+        WallChunk &chunk = wall_chunks[uploaded_chunks];
+        size_t bytes = chunk.vertices()*(2*sizeof(short) + 4) + chunk.indices.size()*sizeof(unsigned short);
 
-    glDrawElements(GL_LINES, wall_indices.size(), GL_UNSIGNED_INT, 0);
+        // At least one chunk goes up per call so a small budget still gets there
+        if(bytes > budget && !first)
+            break;
+        first = false;
+        budget = budget > bytes ? budget - bytes : 0;
 
+        gather_chunk(chunk, true);
+        chunk.colors = chunk_colors;
+        chunk.color_version = color_version;
 
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, end_vertices.size()*sizeof(GLfloat), &end_vertices[0], GL_DYNAMIC_DRAW);
+        glGenVertexArrays(1, &chunk.vao);
+        glGenBuffers(1, &chunk.vbo);
+        glGenBuffers(1, &chunk.color_vbo);
+        glGenBuffers(1, &chunk.ebo);
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, end_indices.size()*sizeof(unsigned int), &end_indices[0], GL_DYNAMIC_DRAW);
+        glBindVertexArray(chunk.vao);
 
-    glDrawElements(GL_TRIANGLES, end_indices.size(), GL_UNSIGNED_INT, 0);
+        // position attribute, the grid shader scales it to world space
+        glBindBuffer(GL_ARRAY_BUFFER, chunk.vbo);
+        glBufferData(GL_ARRAY_BUFFER, chunk_positions.size()*sizeof(short), chunk_positions.data(), GL_STATIC_DRAW);
+        glVertexAttribPointer(0, 2, GL_SHORT, GL_FALSE, 2 * sizeof(short), (void*)0);
+        glEnableVertexAttribArray(0);
 
+        // color attribute
+        glBindBuffer(GL_ARRAY_BUFFER, chunk.color_vbo);
+        glBufferData(GL_ARRAY_BUFFER, chunk.colors.size(), chunk.colors.data(), GL_DYNAMIC_DRAW);
+        glVertexAttribPointer(1, 3, GL_UNSIGNED_BYTE, GL_TRUE, 4, (void*)0);
+        glEnableVertexAttribArray(1);
 
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, bot_kill_vertices.size()*sizeof(GLfloat), &bot_kill_vertices[0], GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, chunk.ebo);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, chunk.indices.size()*sizeof(unsigned short), chunk.indices.data(), GL_STATIC_DRAW);
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, bot_kill_indices.size()*sizeof(unsigned int), &bot_kill_indices[0], GL_DYNAMIC_DRAW);
+        glBindVertexArray(0);
 
-    glDrawElements(GL_TRIANGLES, bot_kill_indices.size(), GL_UNSIGNED_INT, 0);
+        uploaded_chunks++;
+    }
 
+    uploaded = (uploaded_chunks == wall_chunks.size());
+    return uploaded ? EXT_SUCC : EXT_FAIL;
+}
 
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, powerup_vertices.size()*sizeof(GLfloat), &powerup_vertices[0], GL_DYNAMIC_DRAW);
+void Maze::release(){
+    for(int i = 0; i<wall_chunks.size(); i++){
+        WallChunk &chunk = wall_chunks[i];
+        if(chunk.vao == 0)
+            continue;
+        glDeleteVertexArrays(1, &chunk.vao);
+        glDeleteBuffers(1, &chunk.vbo);
+        glDeleteBuffers(1, &chunk.color_vbo);
+        glDeleteBuffers(1, &chunk.ebo);
+        chunk.vao = chunk.vbo = chunk.color_vbo = chunk.ebo = 0;
+    }
+    uploaded_chunks = 0;
+    uploaded = false;
+}
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, powerup_indices.size()*sizeof(unsigned int), &powerup_indices[0], GL_DYNAMIC_DRAW);
+int Maze::draw(unsigned int shaderProgram, GLFWwindow*){
+    PROFILE_ZONE("Maze::draw");
+    glUseProgram(shaderProgram);
 
-    glDrawElements(GL_TRIANGLES, powerup_indices.size(), GL_UNSIGNED_INT, 0);
+    // A maze that was never staged gets all of its walls at once
+    if(!uploaded)
+        upload((size_t)-1);
 
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, powerups_vertices.size()*sizeof(GLfloat), &powerups_vertices[0], GL_DYNAMIC_DRAW);
+    // the model and view matrices, 
+    glm::mat4 model = glm::mat4(1.0f);
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, powerups_indices.size()*sizeof(unsigned int), &powerups_indices[0], GL_DYNAMIC_DRAW);
+    // make the camera look in the 'front' direction
+    glm::mat4 view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
 
-    glDrawElements(GL_TRIANGLES, powerups_indices.size(), GL_UNSIGNED_INT, 0);
+    // assign the uniform values for model and view matrices
+    unsigned int modelLoc = glGetUniformLocation(shaderProgram, "model");
+    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+
+    unsigned int viewLoc = glGetUniformLocation(shaderProgram, "view");
+    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
+
+    // Walls go through the grid shader, which places the packed chunk vertices itself
+    glUseProgram(grid_shader);
+    glUniformMatrix4fv(glGetUniformLocation(grid_shader, "view"), 1, GL_FALSE, glm::value_ptr(view));
+    glUniform2f(glGetUniformLocation(grid_shader, "origin"), wall_vertices[0], wall_vertices[1]);
+    glUniform2f(glGetUniformLocation(grid_shader, "cell"), width, height);
+    glUniform1f(glGetUniformLocation(grid_shader, "units"), GRID_UNITS);
+    unsigned int chunkLoc = glGetUniformLocation(grid_shader, "chunk");
+
+    // Only the chunks on screen are drawn, with the lights on every wall has the same color and no color is sent
+    visible_chunks = 0;
+    for(int i = 0; i<wall_chunks.size(); i++){
+        WallChunk &chunk = wall_chunks[i];
+        if(!chunk.visible(cameraPos))
+            continue;
+
+        glBindVertexArray(chunk.vao);
+        if(lights){
+            glDisableVertexAttribArray(1);
+            glVertexAttrib3f(1, 0.0f, 1.0f, 1.0f);
+        }
+        else{
+            update_colors(chunk);
+            glEnableVertexAttribArray(1);
+        }
+
+        glUniform2f(chunkLoc, chunk.c0, chunk.r0);
+        glDrawElements(chunk.mode(), chunk.indices.size(), GL_UNSIGNED_SHORT, 0);
+        visible_chunks++;
+    }
+
+    glUseProgram(shaderProgram);
+
+    // The markers and pickups are drawn with the rest of the frame's batch
+    frame_batch.add(GL_TRIANGLES, end_vertices, end_indices);
+    frame_batch.add(GL_TRIANGLES, bot_kill_vertices, bot_kill_indices);
+    frame_batch.add(GL_TRIANGLES, powerup_vertices, powerup_indices);
+    frame_batch.add(GL_TRIANGLES, powerups_vertices, powerups_indices);
+
+    return EXT_SUCC;
 }
 
-int Maze::can_move(std::vector<GLfloat> vertices, glm::vec3 pos, int dir){
+int Maze::can_move(std::vector<GLfloat> vertices, glm::vec3 pos, int){
+    PROFILE_ZONE("can_move");
     
     float width = (float)CELL_WIDTH/SCR_WIDTH;
     float height = (float)CELL_WIDTH/SCR_HEIGHT;
@@ -447,9 +855,12 @@ int Maze::can_move(std::vector<GLfloat> vertices, glm::vec3 pos, int dir){
             return EXT_FAIL;
         return EXT_SUCC;
     }
+    // Inside a single cell, no wall is crossed
+    return EXT_SUCC;
 }
 
 std::pair<std::pair<int, int>, std::pair<int, int>> Maze::get_bounds(std::vector<float> vertices, glm::vec3 pos){
+    PROFILE_ZONE("get_bounds");
     float width = (float)CELL_WIDTH/SCR_WIDTH;
     float height = (float)CELL_WIDTH/SCR_HEIGHT;
     
@@ -481,6 +892,15 @@ std::pair<std::pair<int, int>, std::pair<int, int>> Maze::get_bounds(std::vector
     return ret;
 }
 
+bool Maze::contains(std::vector<float> vertices, glm::vec3 pos){
+    std::pair<std::pair<int, int>, std::pair<int, int>> bounds = get_bounds(vertices, pos);
+    if(min(bounds.ff.ff, bounds.ff.ss) < 0 || max(bounds.ff.ff, bounds.ff.ss) >= columns)
+        return false;
+    if(min(bounds.ss.ff, bounds.ss.ss) < 0 || max(bounds.ss.ff, bounds.ss.ss) >= rows)
+        return false;
+    return true;
+}
+
 int Maze::lights_off(){
     lights = false;
     return EXT_SUCC;
@@ -492,6 +912,18 @@ int Maze::lights_on(){
 }
 
 int Maze::update_lights(std::vector<float> vertices, glm::vec3 pos){
+    PROFILE_ZONE("update_lights");
+
+    std::pair<std::pair<int, int>, std::pair<int, int>> bounds = get_bounds(vertices, pos);
+
+    // Nothing to do until the player reaches another cell, the lights flip or the maze changes
+    std::vector<int> key = {lights, builds, (int)powerup_pos.size()};
+    if(!lights)
+        key.insert(key.end(), {bounds.ff.ff, bounds.ff.ss, bounds.ss.ff, bounds.ss.ss});
+    if(key == light_key)
+        return EXT_SUCC;
+    light_key = key;
+    color_version++;
 
     if(lights == true){
         for(int i = 0; i<wall_vertices.size(); i+=6){
@@ -533,8 +965,6 @@ int Maze::update_lights(std::vector<float> vertices, glm::vec3 pos){
         return EXT_SUCC;
     }
 
-    std::pair<std::pair<int, int>, std::pair<int, int>> bounds = get_bounds(vertices, pos);
-
     std::vector<std::vector<int>> dist(rows, std::vector<int>(columns, -1));
 
     std::queue<std::pair<int, int>> q;
@@ -593,6 +1023,11 @@ int Maze::update_lights(std::vector<float> vertices, glm::vec3 pos){
         }
     }
 
+    light_dist.resize(rows*columns);
+    for(int i = 0; i<rows; i++)
+        for(int j = 0; j<columns; j++)
+            light_dist[i*columns+j] = dist[i][j] == -1 ? 255 : min(dist[i][j], 255);
+
     int vert;
     float scale;
 
@@ -652,6 +1087,7 @@ int Maze::update_lights(std::vector<float> vertices, glm::vec3 pos){
 }
 
 int Maze::shortest_path(std::vector<float> src_vertices, glm::vec3 src_pos, std::vector<float> dest_vertices, glm::vec3 dest_pos){
+    PROFILE_ZONE("shortest_path");
     std::pair<std::pair<int, int>, std::pair<int, int>> bounds = get_bounds(dest_vertices, dest_pos);
 
     std::vector<std::vector<int>> dist(rows, std::vector<int>(columns, -1));
@@ -777,28 +1213,72 @@ int Maze::shortest_path(std::vector<float> src_vertices, glm::vec3 src_pos, std:
 
 void Maze::activate_powerups(){
     powerup_activated = true;
+
+    if(!saved_pickups.empty()){
+        for(int i = 0; i<saved_pickups.size(); i++)
+            add_pickup(saved_pickups[i].ff.ff, saved_pickups[i].ff.ss, saved_pickups[i].ss);
+        saved_pickups.clear();
+        return;
+    }
+
+    for(int i = 0; i<NUM_POWERUP; i++){
+        int x = rng() % MAZE_WIDTH;
+        int y = rng() % MAZE_HEIGHT;
+        add_pickup(x, y, rng() % 2);
+    }
+}
+
+void Maze::add_pickup(int x, int y, int kind){
     float height = (float)CELL_WIDTH/SCR_HEIGHT;
     float width = (float)CELL_WIDTH/SCR_WIDTH;
     std::pair<float, float> zero = {-width*(columns/2), height*(rows/2)};
 
-    for(int i = 0; i<NUM_POWERUP; i++){
-        powerup_pos.push_back(std::make_pair(std::make_pair(rand() % MAZE_WIDTH, rand() % MAZE_HEIGHT), rand() % 2));
-        auto cur = powerup_pos.back();
-        for(int j = -1; j<=1; j+=2){
-            for(int k = -1; k<=1; k+=2){
-                powerups_vertices.insert(powerups_vertices.end(), {zero.ff+cur.ff.ff*width+j*(width/4), zero.ss-cur.ff.ss*height+k*(height/4), 0});
-                if(cur.ss == 0){
-                    powerups_vertices.insert(powerups_vertices.end(), {0.0f, 0.5f, 0.5f});
-                }
-                else{
-                    powerups_vertices.insert(powerups_vertices.end(), {1.0f, 0.2f, 0.2f});
-                }
+    unsigned int i = powerup_pos.size();
+    powerup_pos.push_back(std::make_pair(std::make_pair(x, y), kind));
+    auto cur = powerup_pos.back();
+    for(int j = -1; j<=1; j+=2){
+        for(int k = -1; k<=1; k+=2){
+            powerups_vertices.insert(powerups_vertices.end(), {zero.ff+cur.ff.ff*width+j*(width/4), zero.ss-cur.ff.ss*height+k*(height/4), 0});
+            if(cur.ss == 0){
+                powerups_vertices.insert(powerups_vertices.end(), {0.0f, 0.5f, 0.5f});
+            }
+            else{
+                powerups_vertices.insert(powerups_vertices.end(), {1.0f, 0.2f, 0.2f});
             }
         }
-        for(unsigned int j = 0; j<=1; j++){
-            powerups_indices.insert(powerups_indices.end(), {(unsigned int)4*i+j, (unsigned int)4*i+1+j, (unsigned int)4*i+2+j});
-        }
+    }
+    for(unsigned int j = 0; j<=1; j++){
+        powerups_indices.insert(powerups_indices.end(), {4*i+j, 4*i+1+j, 4*i+2+j});
+    }
+}
+
+void Maze::shift_markers(int dr, int dc){
+    std::pair<int, int> *markers[3] = {&end, &bot_kill, &powerup};
+
+    for(int i = 0; i<3; i++){
+        markers[i]->ff -= dc;
+        markers[i]->ss -= dr;
+        if(markers[i]->ff < 0 || markers[i]->ff >= MAZE_WIDTH || markers[i]->ss < 0 || markers[i]->ss >= MAZE_HEIGHT)
+            *markers[i] = std::make_pair(rng() % MAZE_WIDTH, rng() % MAZE_HEIGHT);
+    }
+
+    // Rebuilt so the vertices stay in the same order as powerup_pos
+    std::vector<std::pair<std::pair<int, int>, int>> old = powerup_pos;
+    powerup_pos.clear();
+    powerups_vertices.clear();
+    powerups_indices.clear();
+
+    for(int i = 0; i<old.size(); i++){
+        int x = old[i].ff.ff - dc;
+        int y = old[i].ff.ss - dr;
+        if(old[i].ss == -1 || x < 0 || x >= MAZE_WIDTH || y < 0 || y >= MAZE_HEIGHT)
+            continue;
+        add_pickup(x, y, old[i].ss);
     }
 }
 
+// The engines and the file format need the full Maze definition, so they come after it
+#include "generator.hpp"
+#include "mazefile.hpp"
+
 #endif
\ No newline at end of file